@@ -0,0 +1,2000 @@
+// Command-line front end of the sudoku library
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "sudoku.h"
+
+// Text or bytes staged in memory and handed to write(2) in large pieces.
+// A buffer with fd -1 only collects output, for the caller to copy out.
+typedef struct {
+  int fd;
+  char *data;
+  size_t size; // bytes buffered
+  size_t capacity;
+  bool failed; // a write to fd failed; later output is dropped
+} OutputBuffer;
+
+// Buffers with a file descriptor are written out past this many bytes.
+#define OUTPUT_FLUSH_SIZE (1 << 16)
+
+// How results are emitted: the full text, verdicts only, or one status
+// byte per puzzle (bit 0 complete, bit 1 valid), followed when solving by
+// the cells packed as in a binary corpus.
+typedef enum {
+  OUTPUT_TEXT,
+  OUTPUT_VERDICT,
+  OUTPUT_BINARY,
+} OutputMode;
+
+void outputInit(OutputBuffer *out, int fd) {
+  out->fd = fd;
+  out->data = NULL;
+  out->size = 0;
+  out->capacity = 0;
+  out->failed = false;
+}
+
+// writes out everything buffered; returns false if fd could not take it
+bool outputFlush(OutputBuffer *out) {
+  size_t done = 0;
+  while (out->fd >= 0 && !out->failed && done < out->size) {
+    ssize_t n = write(out->fd, out->data + done, out->size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      out->failed = true;
+    else
+      done += (size_t)n;
+  }
+  if (out->fd >= 0)
+    out->size = 0;
+  return !out->failed;
+}
+
+// returns room for bytes more bytes at out->data + out->size
+static char *outputReserve(OutputBuffer *out, size_t bytes) {
+  if (out->fd >= 0 && out->size + bytes > OUTPUT_FLUSH_SIZE)
+    outputFlush(out);
+  if (out->size + bytes > out->capacity) {
+    out->capacity = 2 * (out->size + bytes);
+    if (out->capacity < OUTPUT_FLUSH_SIZE)
+      out->capacity = OUTPUT_FLUSH_SIZE;
+    out->data = realloc(out->data, out->capacity);
+  }
+  return out->data + out->size;
+}
+
+void outputBytes(OutputBuffer *out, const void *bytes, size_t count) {
+  memcpy(outputReserve(out, count), bytes, count);
+  out->size += count;
+}
+
+void outputString(OutputBuffer *out, const char *text) {
+  outputBytes(out, text, strlen(text));
+}
+
+static inline void outputChar(OutputBuffer *out, char c) {
+  *outputReserve(out, 1) = c;
+  out->size++;
+}
+
+// appends v in decimal, converting two digits per step
+void outputNumber(OutputBuffer *out, unsigned long v) {
+  static const char pairs[] =
+      "000102030405060708091011121314151617181920212223242526272829"
+      "303132333435363738394041424344454647484950515253545556575859"
+      "606162636465666768697071727374757677787980818283848586878889"
+      "90919293949596979899";
+  char digits[20];
+  int i = sizeof(digits);
+  while (v >= 100) {
+    unsigned pair = (unsigned)(v % 100) * 2;
+    v /= 100;
+    digits[--i] = pairs[pair + 1];
+    digits[--i] = pairs[pair];
+  }
+  if (v >= 10) {
+    digits[--i] = pairs[v * 2 + 1];
+    digits[--i] = pairs[v * 2];
+  } else {
+    digits[--i] = (char)('0' + v);
+  }
+  outputBytes(out, digits + i, sizeof(digits) - i);
+}
+
+void outputFree(OutputBuffer *out) {
+  free(out->data);
+  out->data = NULL;
+  out->size = out->capacity = 0;
+}
+
+// takes an output buffer and a grid
+// appends the puzzle in the text puzzle format
+void printSudokuPuzzle(OutputBuffer *out, const SudokuGrid *grid) {
+  int psize = grid->psize;
+  outputNumber(out, psize);
+  outputChar(out, '\n');
+  for (int row = 1; row <= psize; row++) {
+    for (int col = 1; col <= psize; col++) {
+      outputNumber(out, gridGet(grid, row, col));
+      outputChar(out, ' ');
+    }
+    outputChar(out, '\n');
+  }
+  outputChar(out, '\n');
+}
+
+// takes a text input file and the binary file to write
+// converts every puzzle; they must all have the same size.
+// returns false, after printing why, on malformed input or a write error
+bool convertToBinary(const char *textFile, const char *binaryFile) {
+  PuzzleInput in;
+  if (!openPuzzleInput(textFile, &in)) {
+    printf("Could not open file %s\n", textFile);
+    return false;
+  }
+  FILE *out = fopen(binaryFile, "wb");
+  if (out == NULL) {
+    printf("Could not create file %s\n", binaryFile);
+    closePuzzleInput(&in);
+    return false;
+  }
+  uint8_t header[BINARY_HEADER_SIZE] = {0};
+  memcpy(header, BINARY_MAGIC, 4);
+  header[4] = BINARY_VERSION;
+  bool ok = fwrite(header, 1, sizeof(header), out) == sizeof(header);
+  uint64_t count = 0;
+  int psize = 0, bits = 0;
+  uint8_t *packed = NULL;
+  size_t puzzleBytes = 0;
+  char error[128];
+  SudokuGrid *grid;
+  ParseStatus status;
+  while (ok && (status = parseSudokuPuzzle(&in, NULL, &grid, error,
+                                           sizeof(error))) == PARSE_OK) {
+    if (count == 0) {
+      psize = grid->psize;
+      bits = binaryCellBits(psize);
+      puzzleBytes = ((size_t)psize * psize * bits + 7) / 8;
+      packed = malloc(puzzleBytes);
+    } else if (grid->psize != psize) {
+      snprintf(error, sizeof(error), "size %d differs from the first "
+               "puzzle's %d", grid->psize, psize);
+      status = PARSE_ERROR;
+      deleteSudokuPuzzle(grid);
+      break;
+    }
+    packSudokuPuzzle(grid, bits, packed);
+    deleteSudokuPuzzle(grid);
+    ok = fwrite(packed, 1, puzzleBytes, out) == puzzleBytes;
+    count++;
+  }
+  if (ok && status == PARSE_ERROR)
+    printf("puzzle %llu: %s\n", (unsigned long long)count + 1, error);
+  // the size and count are only known now
+  header[5] = (uint8_t)bits;
+  header[6] = (uint8_t)psize;
+  header[7] = (uint8_t)(psize >> 8);
+  for (int i = 0; i < 8; i++)
+    header[8 + i] = (uint8_t)(count >> (8 * i));
+  ok = ok && fseek(out, 0, SEEK_SET) == 0 &&
+       fwrite(header, 1, sizeof(header), out) == sizeof(header);
+  ok = fclose(out) == 0 && ok;
+  if (!ok)
+    printf("Could not write file %s\n", binaryFile);
+  free(packed);
+  closePuzzleInput(&in);
+  return ok && status == PARSE_END;
+}
+
+// takes filename and pointer to a grid
+// returns size of Sudoku puzzle and fills grid; for a binary corpus the
+// first puzzle is read
+int readSudokuPuzzle(char *filename, SudokuGrid **grid) {
+  PuzzleInput in;
+  if (!openPuzzleInput(filename, &in)) {
+    printf("Could not open file %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  char error[128];
+  ParseStatus status;
+  BinaryCorpus corpus;
+  if (!isBinaryInput(&in)) {
+    status = parseSudokuPuzzle(&in, NULL, grid, error, sizeof(error));
+  } else if (!openBinaryCorpus(&in, &corpus, error, sizeof(error))) {
+    status = PARSE_ERROR;
+  } else if (corpus.count == 0) {
+    status = PARSE_END;
+  } else {
+    *grid = createSudokuGrid(corpus.psize);
+    unpackSudokuPuzzle(binaryPuzzle(&corpus, 0), corpus.bits, *grid);
+    status = PARSE_OK;
+  }
+  closePuzzleInput(&in);
+  if (status != PARSE_OK) {
+    printf("Could not read puzzle from %s: %s\n", filename,
+           status == PARSE_END ? "no puzzle found" : error);
+    exit(EXIT_FAILURE);
+  }
+  return (*grid)->psize;
+}
+
+// prints the counters as one line of key=value pairs on stderr
+void printStats(SudokuStats *stats) {
+  if (!SUDOKU_STATS) {
+    fprintf(stderr, "stats unavailable: built with SUDOKU_STATS=0\n");
+    return;
+  }
+  struct {
+    const char *key;
+    atomic_ullong *value;
+  } fields[] = {
+      {"puzzles", &stats->puzzles},
+      {"parse_ns", &stats->parseNanos},
+      {"fill_ns", &stats->fillNanos},
+      {"solve_ns", &stats->solveNanos},
+      {"validate_ns", &stats->validateNanos},
+      {"print_ns", &stats->printNanos},
+      {"pool_ns", &stats->poolNanos},
+      {"threads_created", &stats->threadsCreated},
+      {"tasks", &stats->tasks},
+      {"fill_regions", &stats->fillRegions},
+      {"cells_filled", &stats->cellsFilled},
+      {"fill_conflicts", &stats->fillConflicts},
+      {"solver_calls", &stats->solverCalls},
+      {"solver_nodes", &stats->solverNodes},
+      {"solver_backtracks", &stats->solverBacktracks},
+      {"allocations", &stats->allocations},
+      {"cache_hits", &stats->cacheHits},
+      {"cache_misses", &stats->cacheMisses},
+      {"cache_evictions", &stats->cacheEvictions},
+  };
+  fprintf(stderr, "stats");
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+    fprintf(stderr, " %s=%llu", fields[i].key, atomic_load(fields[i].value));
+  fprintf(stderr, "\n");
+}
+
+// Benchmark harness: times parsing, fill/solve and validation separately
+// over a corpus per board size.
+
+static int compareNanos(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// takes per-puzzle times and prints one result line for a phase
+static void benchReport(int psize, const char *phase, const char *variant,
+                        uint64_t *nanos, int count) {
+  uint64_t total = 0;
+  for (int i = 0; i < count; i++)
+    total += nanos[i];
+  qsort(nanos, count, sizeof(uint64_t), compareNanos);
+  double seconds = total / 1e9;
+  printf("%5d  %-9s %-8s %8d %14.0f %10.2f %10.2f\n", psize, phase, variant,
+         count, seconds > 0 ? count / seconds : 0.0,
+         nanos[count / 2] / 1e3, nanos[(count * 99) / 100] / 1e3);
+}
+
+// takes the puzzles of one size and a context for the pool
+// prints parse, fill/solve and validate timings for them
+static void benchSize(SudokuGrid **puzzles, int count,
+                      const SudokuContext *ctx) {
+  int psize = puzzles[0]->psize;
+  uint64_t *nanos = malloc(count * sizeof(uint64_t));
+  char error[128];
+
+  // parse: the corpus as text, one puzzle per timing
+  OutputBuffer text;
+  outputInit(&text, -1);
+  for (int i = 0; i < count; i++)
+    printSudokuPuzzle(&text, puzzles[i]);
+  PuzzleInput in;
+  openPuzzleBuffer(text.data, text.size, &in);
+  for (int i = 0; i < count; i++) {
+    SudokuGrid *grid;
+    uint64_t start = nowNanos();
+    parseSudokuPuzzle(&in, NULL, &grid, error, sizeof(error));
+    nanos[i] = nowNanos() - start;
+    deleteSudokuPuzzle(grid);
+  }
+  outputFree(&text);
+  benchReport(psize, "parse", "text", nanos, count);
+
+  // fill/solve: on copies, which are kept for validation
+  SudokuGrid **solved = malloc(count * sizeof(SudokuGrid *));
+  int complete = 0;
+  for (int i = 0; i < count; i++) {
+    solved[i] = copySudokuGrid(puzzles[i]);
+    uint64_t start = nowNanos();
+    fillPuzzle(NULL, solved[i]);
+    solvePuzzle(ctx, solved[i]);
+    nanos[i] = nowNanos() - start;
+  }
+  benchReport(psize, "solve", "bitmask", nanos, count);
+  if (ctx->matrices != NULL && psize <= SOLVER_MAX_PSIZE) {
+    SudokuContext dctx = *ctx;
+    dctx.engine = ENGINE_DLX;
+    for (int i = 0; i < count; i++) {
+      SudokuGrid *grid = copySudokuGrid(puzzles[i]);
+      uint64_t start = nowNanos();
+      fillPuzzle(NULL, grid);
+      solvePuzzle(&dctx, grid);
+      nanos[i] = nowNanos() - start;
+      deleteSudokuPuzzle(grid);
+    }
+    benchReport(psize, "solve", "dlx", nanos, count);
+  }
+
+  // validate: every variant on the same boards
+  struct {
+    const char *name;
+    ThreadPolicy threads;
+    bool noSimd;
+    bool noFixed;
+  } variants[] = {{"fanout", THREADS_FANOUT, true, true},
+                  {"chunked", THREADS_CHUNKED, true, true},
+                  {"inline", THREADS_INLINE, true, true},
+                  {"table", THREADS_INLINE, true, true},
+                  {"fixed", THREADS_INLINE, true, false},
+                  {"simd", THREADS_INLINE, false, true}};
+  for (int v = 0; v < 6; v++) {
+    SudokuContext vctx = *ctx;
+    // only the table row uses region tables; inline walks each region
+    if (strcmp(variants[v].name, "table") != 0)
+      vctx.tables = NULL;
+    else if (ctx->tables == NULL || regionTable(ctx->tables, psize) == NULL)
+      continue;
+    vctx.threads = variants[v].threads;
+    vctx.noSimd = variants[v].noSimd;
+    vctx.noFixed = variants[v].noFixed;
+    if (!vctx.noSimd && !simdSupported(solved[0]))
+      continue;
+    if (!vctx.noFixed && !fixedKernelSupported(psize))
+      continue;
+    complete = 0;
+    for (int i = 0; i < count; i++) {
+      bool isComplete, isValid;
+      uint64_t start = nowNanos();
+      verifyPuzzle(&vctx, solved[i], &isComplete, &isValid);
+      nanos[i] = nowNanos() - start;
+      complete += isComplete && isValid;
+    }
+    benchReport(psize, "validate", variants[v].name, nanos, count);
+  }
+  printf("%5d  solved and valid: %d of %d\n", psize, complete, count);
+  for (int i = 0; i < count; i++)
+    deleteSudokuPuzzle(solved[i]);
+  free(solved);
+  free(nanos);
+}
+
+// Default benchmark sizes and clue removal per size. Backtracking slows
+// sharply on big boards near half empty, so those lose fewer clues, and
+// boards beyond the solver's reach only as many as the fill loop handles.
+static const int benchSizes[] = {4, 9, 16, 25, 36, 49, 64, 100};
+
+static double benchHoles(int psize) {
+  if (psize <= 16)
+    return 0.5;
+  return psize <= SOLVER_MAX_PSIZE ? 0.3 : 0.02;
+}
+
+// takes a comma-separated list of sizes and room for 64 of them
+// returns how many were stored, or -1 if one is not a perfect square
+static int parseSizeList(const char *sizes, int *sizeList) {
+  int nsizes = 0;
+  for (const char *p = sizes; *p != '\0' && nsizes < 64; p++) {
+    int psize = (int)strtol(p, (char **)&p, 10);
+    int n = (int)(sqrt(psize) + 0.5);
+    if (psize <= 0 || n * n != psize || psize > MAX_PSIZE)
+      return -1;
+    sizeList[nsizes++] = psize;
+    if (*p == '\0')
+      break;
+  }
+  return nsizes;
+}
+
+// takes the argument after --sizes= (comma-separated sizes, or NULL for
+// the defaults), puzzles per size, a seed, corpus files to load instead
+// of generating (NULL terminated, may be empty) and a context
+// prints a table of timings per size and the peak resident set size
+int runBenchmark(const char *sizes, int count, uint64_t seed, char **files,
+                 const SudokuContext *ctx) {
+  printf("%5s  %-9s %-8s %8s %14s %10s %10s\n", "size", "phase", "variant",
+         "puzzles", "puzzles/sec", "p50_us", "p99_us");
+  if (files[0] != NULL) {
+    // load corpora: each file's puzzles are benchmarked together
+    for (int f = 0; files[f] != NULL; f++) {
+      PuzzleInput in;
+      if (!openPuzzleInput(files[f], &in)) {
+        printf("Could not open file %s\n", files[f]);
+        return EXIT_FAILURE;
+      }
+      int loaded = 0, capacity = 64;
+      SudokuGrid **puzzles = malloc(capacity * sizeof(SudokuGrid *));
+      char error[128];
+      BinaryCorpus corpus;
+      if (isBinaryInput(&in)) {
+        if (!openBinaryCorpus(&in, &corpus, error, sizeof(error))) {
+          printf("%s: %s\n", files[f], error);
+          return EXIT_FAILURE;
+        }
+        puzzles = realloc(puzzles, (corpus.count + 1) * sizeof(SudokuGrid *));
+        for (; (uint64_t)loaded < corpus.count; loaded++) {
+          puzzles[loaded] = createSudokuGrid(corpus.psize);
+          unpackSudokuPuzzle(binaryPuzzle(&corpus, loaded), corpus.bits,
+                             puzzles[loaded]);
+        }
+      } else {
+        SudokuGrid *grid;
+        while (parseSudokuPuzzle(&in, NULL, &grid, error, sizeof(error)) ==
+               PARSE_OK) {
+          if (loaded > 0 && grid->psize != puzzles[0]->psize) {
+            deleteSudokuPuzzle(grid);
+            break; // one size per corpus
+          }
+          if (loaded == capacity)
+            puzzles = realloc(puzzles, (capacity *= 2) * sizeof(SudokuGrid *));
+          puzzles[loaded++] = grid;
+        }
+      }
+      closePuzzleInput(&in);
+      if (loaded > 0)
+        benchSize(puzzles, loaded, ctx);
+      for (int i = 0; i < loaded; i++)
+        deleteSudokuPuzzle(puzzles[i]);
+      free(puzzles);
+    }
+  } else {
+    int sizeList[64], nsizes = 0;
+    if (sizes == NULL) {
+      nsizes = sizeof(benchSizes) / sizeof(benchSizes[0]);
+      memcpy(sizeList, benchSizes, sizeof(benchSizes));
+    } else if ((nsizes = parseSizeList(sizes, sizeList)) < 0) {
+      printf("benchmark sizes must be perfect squares\n");
+      return EXIT_FAILURE;
+    }
+    uint64_t rng = seed;
+    SudokuGrid **puzzles = malloc(count * sizeof(SudokuGrid *));
+    for (int s = 0; s < nsizes; s++) {
+      for (int i = 0; i < count; i++) {
+        puzzles[i] = generateSolvedGrid(sizeList[s], &rng);
+        removeClues(puzzles[i], benchHoles(sizeList[s]), &rng);
+      }
+      benchSize(puzzles, count, ctx);
+      for (int i = 0; i < count; i++)
+        deleteSudokuPuzzle(puzzles[i]);
+    }
+    free(puzzles);
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("peak_rss_kb=%ld\n", usage.ru_maxrss);
+  return EXIT_SUCCESS;
+}
+
+// Puzzles generated per round; each round is made in parallel.
+#define GENERATE_CHUNK 1024
+
+// One puzzle of a generated corpus and where it was written.
+typedef struct {
+  const SudokuContext *ctx;
+  const GeneratorSpec *spec;
+  uint64_t seed;
+  uint64_t index;        // position in the corpus, which picks the puzzle
+  OutputMode mode;
+  OutputBuffer *outputs; // one per worker, then one for the caller
+  int outputCount;
+  int output;            // buffer the puzzle was written into
+  size_t textStart;      // puzzle bytes at outputs[output].data + textStart
+  size_t textSize;
+} GenerateItem;
+
+// Thread function to make one puzzle of a corpus and write it, packed or
+// as text, into the running worker's buffer.
+static void *generateItem(void *param) {
+  GenerateItem *item = (GenerateItem *)param;
+  SudokuGrid *grid =
+      generatePuzzle(item->ctx, item->spec, item->seed, item->index);
+  int worker = threadPoolCurrentWorker(item->ctx->pool);
+  item->output = worker < 0 ? item->outputCount - 1 : worker;
+  OutputBuffer *out = &item->outputs[item->output];
+  item->textStart = out->size;
+  if (item->mode == OUTPUT_BINARY) {
+    int psize = grid->psize;
+    int bits = binaryCellBits(psize);
+    size_t bytes = ((size_t)psize * psize * bits + 7) / 8;
+    packSudokuPuzzle(grid, bits, (uint8_t *)outputReserve(out, bytes));
+    out->size += bytes;
+  } else {
+    printSudokuPuzzle(out, grid);
+  }
+  item->textSize = out->size - item->textStart;
+  deleteSudokuPuzzle(grid);
+  return NULL;
+}
+
+// takes the argument after --sizes= (or NULL for 9x9), puzzles per size, a
+// spec whose psize is filled in per size (holes < 0 picks the benchmark
+// default for each size), a seed, an output mode (text or binary), the file
+// to write (NULL or "-" for stdout) and a context
+// writes count puzzles of each size, made in parallel and written in
+// order; the same arguments always give the same corpus. Binary output
+// is a corpus with the usual header, so it takes a single size.
+// returns false, after printing why, on bad arguments or a write error
+bool runGenerator(const char *sizes, int count, GeneratorSpec spec,
+                  uint64_t seed, OutputMode mode, const char *filename,
+                  const SudokuContext *ctx) {
+  int sizeList[64] = {9}, nsizes = 1;
+  if (sizes != NULL && (nsizes = parseSizeList(sizes, sizeList)) < 0) {
+    printf("generator sizes must be perfect squares\n");
+    return false;
+  }
+  if (mode == OUTPUT_BINARY && nsizes > 1) {
+    printf("a binary corpus holds a single size\n");
+    return false;
+  }
+  for (int s = 0; s < nsizes; s++) {
+    if (spec.clues > sizeList[s] * sizeList[s]) {
+      printf("size %d has only %d cells\n", sizeList[s],
+             sizeList[s] * sizeList[s]);
+      return false;
+    }
+    if (spec.unique && sizeList[s] > SOLVER_MAX_PSIZE) {
+      printf("uniqueness can only be checked up to size %d\n",
+             SOLVER_MAX_PSIZE);
+      return false;
+    }
+  }
+  int fd = STDOUT_FILENO;
+  if (filename != NULL && strcmp(filename, "-") != 0 &&
+      (fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    printf("Could not create file %s\n", filename);
+    return false;
+  }
+  // each puzzle is made on one worker, as in batch mode
+  SudokuContext itemCtx = *ctx;
+  if (itemCtx.threads == THREADS_AUTO)
+    itemCtx.threads = THREADS_INLINE;
+  GenerateItem *items = malloc(GENERATE_CHUNK * sizeof(GenerateItem));
+  int outputCount = threadPoolSize(ctx->pool) + 1;
+  OutputBuffer *outputs = malloc(outputCount * sizeof(OutputBuffer));
+  for (int i = 0; i < outputCount; i++)
+    outputInit(&outputs[i], -1);
+  OutputBuffer out;
+  fflush(stdout);
+  outputInit(&out, fd);
+  if (mode == OUTPUT_BINARY) {
+    uint8_t header[BINARY_HEADER_SIZE] = {0};
+    memcpy(header, BINARY_MAGIC, 4);
+    header[4] = BINARY_VERSION;
+    header[5] = (uint8_t)binaryCellBits(sizeList[0]);
+    header[6] = (uint8_t)sizeList[0];
+    header[7] = (uint8_t)(sizeList[0] >> 8);
+    for (int i = 0; i < 8; i++)
+      header[8 + i] = (uint8_t)((uint64_t)count >> (8 * i));
+    outputBytes(&out, header, sizeof(header));
+  }
+  uint64_t index = 0;
+  for (int s = 0; s < nsizes; s++) {
+    GeneratorSpec sizeSpec = spec;
+    sizeSpec.psize = sizeList[s];
+    if (sizeSpec.holes < 0)
+      sizeSpec.holes = benchHoles(sizeList[s]);
+    for (int done = 0; done < count;) {
+      TaskGroup group = {0};
+      for (int i = 0; i < outputCount; i++)
+        outputs[i].size = 0;
+      int round = count - done < GENERATE_CHUNK ? count - done
+                                                : GENERATE_CHUNK;
+      for (int i = 0; i < round; i++) {
+        GenerateItem *item = &items[i];
+        item->ctx = &itemCtx;
+        item->spec = &sizeSpec;
+        item->seed = seed;
+        item->index = index++;
+        item->mode = mode;
+        item->outputs = outputs;
+        item->outputCount = outputCount;
+        threadPoolSubmit(ctx->pool, &group, generateItem, item);
+      }
+      STAT_ADD(ctx->stats, tasks, round);
+      threadPoolWait(ctx->pool, &group);
+      for (int i = 0; i < round; i++)
+        outputBytes(&out, outputs[items[i].output].data + items[i].textStart,
+                    items[i].textSize);
+      done += round;
+    }
+  }
+  bool written = outputFlush(&out);
+  outputFree(&out);
+  for (int i = 0; i < outputCount; i++)
+    outputFree(&outputs[i]);
+  free(outputs);
+  free(items);
+  if (fd != STDOUT_FILENO)
+    written = close(fd) == 0 && written;
+  if (!written)
+    printf("Could not write file %s\n", filename == NULL ? "-" : filename);
+  return written;
+}
+
+// Bounded queue handing pointers from one thread to one other. Pushes and
+// pops are lock-free; a side takes the lock only to sleep, when the queue
+// is full or empty, and the other side wakes it after it moves an index.
+#define SPSC_CAPACITY 8 // a power of two
+
+typedef struct {
+  void *slots[SPSC_CAPACITY];
+  _Alignas(64) atomic_size_t head; // next slot to pop, moved by the consumer
+  _Alignas(64) atomic_size_t tail; // next slot to push, moved by the producer
+  atomic_int sleepers;             // sides waiting on wake
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} SpscQueue;
+
+static void spscInit(SpscQueue *q) {
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  atomic_init(&q->sleepers, 0);
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->wake, NULL);
+}
+
+static void spscDestroy(SpscQueue *q) {
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->wake);
+}
+
+// returns whether q has room to push (or, if popping, an item to pop)
+static inline bool spscReady(SpscQueue *q, bool popping) {
+  size_t used = atomic_load(&q->tail) - atomic_load(&q->head);
+  return popping ? used > 0 : used < SPSC_CAPACITY;
+}
+
+// blocks until spscReady(q, popping). The sleeper is announced before
+// the last check and indices are published before sleepers is read, all
+// sequentially consistent, so a wakeup is never lost.
+static void spscWait(SpscQueue *q, bool popping) {
+  if (spscReady(q, popping))
+    return;
+  pthread_mutex_lock(&q->lock);
+  atomic_fetch_add(&q->sleepers, 1);
+  while (!spscReady(q, popping))
+    pthread_cond_wait(&q->wake, &q->lock);
+  atomic_fetch_sub(&q->sleepers, 1);
+  pthread_mutex_unlock(&q->lock);
+}
+
+// wakes the other side of q if it is asleep
+static inline void spscWake(SpscQueue *q) {
+  if (atomic_load(&q->sleepers) > 0) {
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_broadcast(&q->wake);
+    pthread_mutex_unlock(&q->lock);
+  }
+}
+
+// appends item, waiting for room
+static void spscPush(SpscQueue *q, void *item) {
+  spscWait(q, false);
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  q->slots[tail % SPSC_CAPACITY] = item;
+  atomic_store(&q->tail, tail + 1);
+  spscWake(q);
+}
+
+// returns the oldest item, waiting for one
+static void *spscPop(SpscQueue *q) {
+  spscWait(q, true);
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  void *item = q->slots[head % SPSC_CAPACITY];
+  atomic_store(&q->head, head + 1);
+  spscWake(q);
+  return item;
+}
+
+// Puzzles read per round in batch mode; each round is checked in parallel.
+#define BATCH_CHUNK 1024
+
+// One puzzle of a batch and its verdict.
+typedef struct {
+  const SudokuContext *ctx;
+  SudokuGrid *grid;
+  const uint8_t *packed; // cells still to unpack into grid, or NULL
+  int bits;              // bits per packed cell
+  long number;   // 1-based position in the batch
+  bool solve;    // fill in missing numbers before verifying
+  long solutionLimit; // if > 0, count solutions up to this instead
+  long solutions;
+  OutputMode mode;
+  OutputBuffer *outputs; // one per worker, then one for the caller
+  int outputCount;
+  int output;    // buffer the result was formatted into
+  size_t textStart; // result bytes at outputs[output].data + textStart
+  size_t textSize;
+  bool complete;
+  bool valid;
+} BatchItem;
+
+// takes an output buffer, a count from countSolutions and its limit
+// appends the count, "K+" if the limit was reached or "unknown" if the
+// board is too large for the solver
+void formatSolutionCount(OutputBuffer *out, long count, long limit) {
+  if (count < 0) {
+    outputString(out, "unknown");
+    return;
+  }
+  outputNumber(out, count);
+  if (count == limit)
+    outputChar(out, '+');
+}
+
+// takes an output buffer and a checked batch item
+// appends the item's result as its output mode says
+static void formatBatchItem(OutputBuffer *out, const BatchItem *item) {
+  if (item->solutionLimit > 0 && item->mode == OUTPUT_BINARY) {
+    // little-endian 32-bit count, -1 if the board is too large
+    uint32_t count = (uint32_t)(int32_t)item->solutions;
+    for (int i = 0; i < 4; i++)
+      outputChar(out, (char)(count >> (8 * i)));
+    return;
+  }
+  if (item->solutionLimit > 0) {
+    outputNumber(out, item->number);
+    outputString(out, " solutions=");
+    formatSolutionCount(out, item->solutions, item->solutionLimit);
+    outputChar(out, '\n');
+    return;
+  }
+  if (item->mode == OUTPUT_BINARY) {
+    outputChar(out, (char)(item->complete | item->valid << 1));
+    if (item->solve) {
+      int psize = item->grid->psize;
+      int bits = binaryCellBits(psize);
+      size_t bytes = ((size_t)psize * psize * bits + 7) / 8;
+      packSudokuPuzzle(item->grid, bits, (uint8_t *)outputReserve(out, bytes));
+      out->size += bytes;
+    }
+    return;
+  }
+  outputNumber(out, item->number);
+  outputString(out, item->complete ? " complete=true" : " complete=false");
+  outputString(out, item->valid ? " valid=true" : " valid=false");
+  if (item->solve && item->mode == OUTPUT_TEXT) {
+    outputString(out, " :");
+    int psize = item->grid->psize;
+    for (int row = 1; row <= psize; row++) {
+      for (int col = 1; col <= psize; col++) {
+        outputChar(out, ' ');
+        outputNumber(out, gridGet(item->grid, row, col));
+      }
+    }
+  }
+  outputChar(out, '\n');
+}
+
+// takes a batch item
+// checks its puzzle as the item says, leaving the verdict in the item
+static void runBatchItem(BatchItem *item) {
+  if (item->grid == NULL)
+    return; // verified while it was read
+  if (item->packed != NULL)
+    unpackSudokuPuzzle(item->packed, item->bits, item->grid);
+  if (item->solutionLimit > 0)
+    item->solutions = countSolutions(item->ctx, item->grid,
+                                     item->solutionLimit);
+  else if (item->solve)
+    checkPuzzle(item->ctx, item->grid, &item->complete, &item->valid);
+  else
+    verifyPuzzle(item->ctx, item->grid, &item->complete, &item->valid);
+}
+
+// Thread function to check one puzzle of a batch. The result is formatted
+// into the running worker's buffer, to be copied out in input order.
+void *checkBatchItem(void *param) {
+  BatchItem *item = (BatchItem *)param;
+  runBatchItem(item);
+  int worker = threadPoolCurrentWorker(item->ctx->pool);
+  item->output = worker < 0 ? item->outputCount - 1 : worker;
+  OutputBuffer *out = &item->outputs[item->output];
+  item->textStart = out->size;
+  formatBatchItem(out, item);
+  item->textSize = out->size - item->textStart;
+  return NULL;
+}
+
+// Boards this large that are only verified are checked as they are read,
+// without building their grid.
+#define BATCH_STREAM_PSIZE 256
+
+// Rounds of a batch in flight at once: one being read while the others
+// are checked or written.
+#define BATCH_ROUNDS 4
+
+// A round of a batch: its puzzles, the grids they were parsed into and a
+// buffer per worker for their results, reused once the round is written.
+typedef struct {
+  BatchItem items[BATCH_CHUNK];
+  int count;
+  Arena grids;
+  ArenaMark start;       // the empty arena, to drop every grid at once
+  OutputBuffer *outputs; // one per worker, then one for the caller
+  TaskGroup group;
+  bool last;             // the reader stopped after this round
+  ParseStatus status;    // why it stopped, if last
+  long errorNumber;      // puzzle the error is reported for
+  char error[128];
+} BatchRound;
+
+// The writer stage: takes rounds in input order from full, writes them
+// and hands them back through spare.
+typedef struct {
+  SpscQueue full;
+  SpscQueue spare;
+  ThreadPool *pool;
+  SudokuStats *stats;
+  OutputMode mode;
+  OutputBuffer out;
+} BatchWriter;
+
+// takes the writer and a round the reader has finished
+// waits for the round's checks and writes its results, then the error
+// that ended the batch if there was one
+static void batchWriteRound(BatchWriter *writer, BatchRound *round) {
+  threadPoolWait(writer->pool, &round->group);
+  uint64_t start = STAT_START(writer->stats);
+  OutputBuffer *out = &writer->out;
+  for (int i = 0; i < round->count; i++) {
+    BatchItem *item = &round->items[i];
+    outputBytes(out, round->outputs[item->output].data + item->textStart,
+                item->textSize);
+  }
+  if (round->status == PARSE_ERROR && writer->mode == OUTPUT_BINARY) {
+    outputFlush(out);
+    fprintf(stderr, "%ld error: %s\n", round->errorNumber, round->error);
+  } else if (round->status == PARSE_ERROR) {
+    outputNumber(out, round->errorNumber);
+    outputString(out, " error: ");
+    outputString(out, round->error);
+    outputChar(out, '\n');
+  }
+  // the grids go back to the reader together
+  arenaRelease(&round->grids, round->start);
+  STAT_STOP(writer->stats, printNanos, start);
+}
+
+// Thread function of the writer stage.
+static void *batchWriter(void *param) {
+  BatchWriter *writer = (BatchWriter *)param;
+  for (;;) {
+    BatchRound *round = spscPop(&writer->full);
+    batchWriteRound(writer, round);
+    if (round->last)
+      return NULL;
+    spscPush(&writer->spare, round);
+  }
+}
+
+// takes an input of concatenated puzzles, a context, whether to solve, a
+// solution limit and an output mode
+// writes one result per puzzle to stdout: in text mode its number, verdict
+// and, if solving, the cells in row order. With a positive solution
+// limit each puzzle's solutions are counted up to it instead, as
+// "N solutions=C" or, in binary, a 32-bit count. Puzzles are the unit of
+// parallelism here, so unless ctx pins a policy each puzzle's regions are
+// validated on its worker, which also formats the result into a buffer of
+// its own. The batch runs as a pipeline of rounds: the calling thread
+// parses a round and hands its puzzles to the pool, the pool checks them,
+// and a writer thread waits for each round in turn and copies its results
+// out in order, so reading, checking and writing overlap. Text boards of
+// BATCH_STREAM_PSIZE and up that are only verified are checked while they
+// are parsed, so no grid is held for them. Binary corpora are read in
+// place, each worker unpacking its puzzles. Malformed input ends the batch
+// with an error line for that puzzle, on stderr in binary mode.
+// returns false if the input was malformed or stdout could not be written
+bool runBatch(PuzzleInput *in, const SudokuContext *ctx, bool solve,
+              long solutionLimit, OutputMode mode) {
+  SudokuContext itemCtx = *ctx;
+  if (itemCtx.threads == THREADS_AUTO)
+    itemCtx.threads = THREADS_INLINE;
+  // the writer may run tasks on ctx->scratch, so the reader has its own
+  Arena readerScratch = {NULL};
+  SudokuContext readerCtx = itemCtx;
+  readerCtx.scratch = &readerScratch;
+  int outputCount = threadPoolSize(ctx->pool) + 1;
+  BatchRound *rounds[BATCH_ROUNDS];
+  BatchWriter writer = {.pool = ctx->pool, .stats = ctx->stats, .mode = mode};
+  spscInit(&writer.full);
+  spscInit(&writer.spare);
+  for (int r = 0; r < BATCH_ROUNDS; r++) {
+    BatchRound *round = malloc(sizeof(BatchRound));
+    round->grids = (Arena){NULL};
+    round->start = arenaMark(&round->grids);
+    round->outputs = malloc(outputCount * sizeof(OutputBuffer));
+    for (int i = 0; i < outputCount; i++)
+      outputInit(&round->outputs[i], -1);
+    rounds[r] = round;
+    spscPush(&writer.spare, round);
+  }
+  fflush(stdout);
+  outputInit(&writer.out, STDOUT_FILENO);
+  // without a writer thread each round is written as soon as it is read
+  pthread_t writerThread;
+  bool threaded =
+      pthread_create(&writerThread, NULL, batchWriter, &writer) == 0;
+  long puzzleNumber = 0;
+  ParseStatus status = PARSE_OK;
+  BinaryCorpus corpus;
+  bool binary = isBinaryInput(in);
+  uint64_t nextBinary = 0;
+  char error[128];
+  if (binary && !openBinaryCorpus(in, &corpus, error, sizeof(error)))
+    status = PARSE_ERROR;
+  for (bool last = false; !last;) {
+    BatchRound *round = spscPop(&writer.spare);
+    round->group = (TaskGroup){0};
+    for (int i = 0; i < outputCount; i++)
+      round->outputs[i].size = 0;
+    uint64_t start = STAT_START(ctx->stats);
+    int count = 0;
+    for (; status == PARSE_OK && count < BATCH_CHUNK; count++) {
+      BatchItem *item = &round->items[count];
+      item->packed = NULL;
+      if (binary) {
+        status = nextBinary < corpus.count ? PARSE_OK : PARSE_END;
+        if (status != PARSE_OK)
+          break;
+        item->grid = arenaCreateGrid(&round->grids, corpus.psize);
+        item->packed = binaryPuzzle(&corpus, nextBinary++);
+        item->bits = corpus.bits;
+      } else if (!solve && solutionLimit == 0) {
+        status = parseOrVerifyPuzzle(&readerCtx, in, BATCH_STREAM_PSIZE,
+                                     &round->grids, &item->grid,
+                                     &item->complete, &item->valid, error,
+                                     sizeof(error));
+        if (status != PARSE_OK)
+          break;
+      } else {
+        status = parseSudokuPuzzle(in, &round->grids, &item->grid, error,
+                                   sizeof(error));
+        if (status != PARSE_OK)
+          break;
+      }
+      item->ctx = &itemCtx;
+      item->number = puzzleNumber + count + 1;
+      item->solve = solve;
+      item->solutionLimit = solutionLimit;
+      item->mode = mode;
+      item->outputs = round->outputs;
+      item->outputCount = outputCount;
+      threadPoolSubmit(ctx->pool, &round->group, checkBatchItem, item);
+    }
+    // parse time includes handing puzzles to the pool, not checking them
+    STAT_STOP(ctx->stats, parseNanos, start);
+    STAT_ADD(ctx->stats, tasks, count);
+    puzzleNumber += count;
+    round->count = count;
+    last = status != PARSE_OK;
+    round->last = last;
+    round->status = status;
+    if (status == PARSE_ERROR) {
+      round->errorNumber = puzzleNumber + 1;
+      memcpy(round->error, error, sizeof(error));
+    }
+    if (threaded) {
+      spscPush(&writer.full, round);
+    } else {
+      batchWriteRound(&writer, round);
+      spscPush(&writer.spare, round);
+    }
+  }
+  if (threaded)
+    pthread_join(writerThread, NULL);
+  bool written = outputFlush(&writer.out);
+  outputFree(&writer.out);
+  for (int r = 0; r < BATCH_ROUNDS; r++) {
+    for (int i = 0; i < outputCount; i++)
+      outputFree(&rounds[r]->outputs[i]);
+    free(rounds[r]->outputs);
+    arenaDestroy(&rounds[r]->grids);
+    free(rounds[r]);
+  }
+  spscDestroy(&writer.full);
+  spscDestroy(&writer.spare);
+  arenaDestroy(&readerScratch);
+  return status != PARSE_ERROR && written;
+}
+
+// takes a board and a region number
+// appends the region as "row R", "column C" or "box B", 1-indexed
+static void formatRegion(OutputBuffer *out, const SudokuBoard *board,
+                         int region) {
+  int psize = boardGrid(board)->psize;
+  outputString(out, region < psize       ? "row "
+                    : region < 2 * psize ? "column "
+                                         : "box ");
+  outputNumber(out, region % psize + 1);
+}
+
+// takes a board to edit
+// reads "row col num" edits from stdin, num 0 clearing the cell, and after
+// each one prints whether the board is complete and valid and which of the
+// cell's regions conflict. Flushes after every line for interactive use.
+// returns false if an edit line was malformed or out of range
+bool runEdits(SudokuBoard *board) {
+  OutputBuffer out;
+  fflush(stdout);
+  outputInit(&out, STDOUT_FILENO);
+  char line[128];
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), stdin) != NULL) {
+    int row, col, num, conflicts[3];
+    char extra;
+    if (sscanf(line, "%d %d %d %c", &row, &col, &num, &extra) != 3) {
+      if (sscanf(line, " %c", &extra) != 1)
+        continue; // blank line
+      outputString(&out, "error: expected row column number\n");
+      ok = false;
+    } else {
+      int count = boardSet(board, row, col, num, conflicts);
+      if (count < 0) {
+        outputString(&out, "error: edit out of range\n");
+        ok = false;
+      } else {
+        outputString(&out, boardComplete(board) ? "complete=true"
+                                                : "complete=false");
+        outputString(&out, boardValid(board) ? " valid=true" : " valid=false");
+        outputString(&out, " conflicts=");
+        for (int i = 0; i < count; i++) {
+          if (i > 0)
+            outputChar(&out, ',');
+          formatRegion(&out, board, conflicts[i]);
+        }
+        outputChar(&out, '\n');
+      }
+    }
+    outputFlush(&out);
+  }
+  outputFree(&out);
+  return ok;
+}
+
+// Server mode. Each connection has a reader thread, which takes request
+// frames off the socket and hands their puzzles to the shared pool, and a
+// writer, which sends the responses back in request order as they become
+// ready, so a client may pipeline any number of requests.
+//
+// A request frame is a length and that many bytes: an op and a body.
+//   'v'  verify the puzzles in the body as given, as --batch does
+//   's'  fill in and solve them first, as --batch --solve does
+//   'q'  report the server's counters; the body is empty
+// The body holds text puzzles or a binary corpus. A response frame is a
+// length, a status byte (0 ok, 1 malformed body) and the results as
+// --batch prints them, then for status 1 the error. Lengths are uint32,
+// little-endian, and do not count themselves.
+
+// Longest request accepted; a longer length ends the connection.
+#define SERVER_MAX_FRAME (1u << 30)
+
+// Requests read ahead of the oldest unanswered one on a connection.
+#define SERVER_MAX_INFLIGHT 64
+
+// Bytes the reader asks the socket for at a time.
+#define SERVER_READ_SIZE (1 << 16)
+
+// Request latencies are counted in powers of two of microseconds.
+#define LATENCY_BUCKETS 32
+
+typedef struct Request Request;
+typedef struct Connection Connection;
+typedef struct Server Server;
+
+// One puzzle of a request.
+typedef struct {
+  BatchItem item;
+  Request *request;
+} ServerItem;
+
+// A request frame and its results. Requests are recycled by their
+// connection, keeping the body, item and grid memory for the next one.
+struct Request {
+  Request *next;
+  Connection *conn;
+  char op;
+  char *body;          // op byte, then the puzzles
+  size_t size;
+  size_t capacity;
+  Arena grids;
+  ServerItem *items;
+  int count;
+  int itemCapacity;
+  atomic_int remaining; // items still being checked
+  ParseStatus status;
+  char error[128];
+  uint64_t received;   // nowNanos when the frame had been read
+};
+
+struct Connection {
+  Server *server;
+  int fd;
+  pthread_t reader;
+  pthread_mutex_t lock;
+  pthread_cond_t changed; // a request was queued, finished or answered
+  Request *head;          // unanswered requests in arrival order
+  Request *tail;
+  Request *spare;         // answered requests for reuse
+  int inflight;
+  bool readDone;          // no more requests will be queued
+  char *in;               // bytes read ahead from fd
+  size_t inPos;
+  size_t inSize;
+  Connection *next;       // in server->connections
+};
+
+struct Server {
+  SudokuContext itemCtx; // context the puzzles are checked with
+  OutputMode mode;
+  int listenFd;
+  const char *unixPath;  // socket file to remove at exit, or NULL
+  int wake[2];           // pipe written once a stop signal arrives
+  sigset_t signals;
+  pthread_mutex_t lock;  // guards connections
+  pthread_cond_t idle;   // the last connection ended
+  Connection *connections;
+  TaskGroup group;       // every item; the pool still updates it after an
+                         // item's request is answered, so it outlives them
+  atomic_ullong accepted;
+  atomic_ullong requests;
+  atomic_ullong puzzles;
+  atomic_llong inflightRequests;
+  atomic_llong inflightPuzzles;
+  atomic_llong peakInflightPuzzles;
+  atomic_ullong latency[LATENCY_BUCKETS]; // bucket i: under 2^i us
+};
+
+// takes a connection and a buffer
+// reads exactly size bytes through the connection's read-ahead buffer
+// returns false at the end of the stream or on an error
+static bool connectionRead(Connection *conn, void *data, size_t size) {
+  char *to = data;
+  while (size > 0) {
+    if (conn->inPos == conn->inSize) {
+      // large reads go straight to the caller's buffer
+      bool direct = size >= SERVER_READ_SIZE;
+      ssize_t n = read(conn->fd, direct ? to : conn->in,
+                       direct ? size : SERVER_READ_SIZE);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      if (direct) {
+        to += n;
+        size -= n;
+        continue;
+      }
+      conn->inPos = 0;
+      conn->inSize = n;
+    }
+    size_t take = conn->inSize - conn->inPos;
+    if (take > size)
+      take = size;
+    memcpy(to, conn->in + conn->inPos, take);
+    conn->inPos += take;
+    to += take;
+    size -= take;
+  }
+  return true;
+}
+
+// returns false if fd did not take all size bytes
+static bool sendFully(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// marks one item of req checked; the last one wakes the writer
+static void requestItemDone(Request *req) {
+  if (atomic_fetch_sub(&req->remaining, 1) != 1)
+    return;
+  Connection *conn = req->conn;
+  pthread_mutex_lock(&conn->lock);
+  pthread_cond_broadcast(&conn->changed);
+  pthread_mutex_unlock(&conn->lock);
+}
+
+// Thread function to check one puzzle of a request.
+static void *checkServerItem(void *param) {
+  ServerItem *si = (ServerItem *)param;
+  runBatchItem(&si->item);
+  requestItemDone(si->request);
+  return NULL;
+}
+
+// returns the next free item of req, growing the items while none of them
+// has been submitted
+static ServerItem *requestAddItem(Request *req) {
+  if (req->count == req->itemCapacity) {
+    req->itemCapacity = req->itemCapacity == 0 ? 16 : 2 * req->itemCapacity;
+    req->items = realloc(req->items, req->itemCapacity * sizeof(ServerItem));
+  }
+  return &req->items[req->count++];
+}
+
+// takes a queued request whose body has been read
+// parses its puzzles and submits them to the pool
+static void serverStartRequest(Server *server, Request *req) {
+  req->count = 0;
+  req->status = PARSE_OK;
+  if (req->op == 'v' || req->op == 's') {
+    PuzzleInput in;
+    openPuzzleBuffer(req->body + 1, req->size - 1, &in);
+    BinaryCorpus corpus;
+    if (!isBinaryInput(&in)) {
+      SudokuGrid *grid;
+      ParseStatus status;
+      while ((status = parseSudokuPuzzle(&in, &req->grids, &grid, req->error,
+                                         sizeof(req->error))) == PARSE_OK) {
+        ServerItem *si = requestAddItem(req);
+        si->item.grid = grid;
+        si->item.packed = NULL;
+      }
+      req->status = status == PARSE_END ? PARSE_OK : PARSE_ERROR;
+    } else if (!openBinaryCorpus(&in, &corpus, req->error,
+                                 sizeof(req->error))) {
+      req->status = PARSE_ERROR;
+    } else {
+      for (uint64_t i = 0; i < corpus.count; i++) {
+        ServerItem *si = requestAddItem(req);
+        si->item.grid = arenaCreateGrid(&req->grids, corpus.psize);
+        si->item.packed = binaryPuzzle(&corpus, i);
+        si->item.bits = corpus.bits;
+      }
+    }
+  } else if (req->op != 'q') {
+    snprintf(req->error, sizeof(req->error), "unknown request type");
+    req->status = PARSE_ERROR;
+  }
+  long long inflight =
+      atomic_fetch_add(&server->inflightPuzzles, req->count) + req->count;
+  long long peak = atomic_load(&server->peakInflightPuzzles);
+  while (inflight > peak &&
+         !atomic_compare_exchange_weak(&server->peakInflightPuzzles, &peak,
+                                       inflight))
+    ;
+  atomic_fetch_add(&server->inflightRequests, 1);
+  atomic_fetch_add(&server->requests, 1);
+  atomic_fetch_add(&server->puzzles, req->count);
+  STAT_ADD(server->itemCtx.stats, tasks, req->count);
+  atomic_fetch_add(&req->remaining, req->count);
+  for (int i = 0; i < req->count; i++) {
+    ServerItem *si = &req->items[i];
+    si->request = req;
+    si->item.ctx = &server->itemCtx;
+    si->item.number = i + 1;
+    si->item.solve = req->op == 's';
+    si->item.solutionLimit = 0;
+    si->item.mode = server->mode;
+    threadPoolSubmit(server->itemCtx.pool, &server->group, checkServerItem,
+                     si);
+  }
+  requestItemDone(req);
+}
+
+// Thread function reading the requests of a connection until the client
+// stops sending, the connection fails or the server shuts it down.
+static void *serverReader(void *param) {
+  Connection *conn = (Connection *)param;
+  uint8_t header[4];
+  while (connectionRead(conn, header, sizeof(header))) {
+    uint32_t length = (uint32_t)header[0] | (uint32_t)header[1] << 8 |
+                      (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+    if (length == 0 || length > SERVER_MAX_FRAME)
+      break;
+    pthread_mutex_lock(&conn->lock);
+    while (conn->inflight >= SERVER_MAX_INFLIGHT)
+      pthread_cond_wait(&conn->changed, &conn->lock);
+    Request *req = conn->spare;
+    if (req != NULL)
+      conn->spare = req->next;
+    pthread_mutex_unlock(&conn->lock);
+    if (req == NULL) {
+      req = calloc(1, sizeof(Request));
+      req->conn = conn;
+    }
+    if (req->capacity < length) {
+      free(req->body);
+      req->capacity = length;
+      req->body = malloc(length);
+    }
+    req->size = length;
+    if (!connectionRead(conn, req->body, length)) {
+      pthread_mutex_lock(&conn->lock);
+      req->next = conn->spare;
+      conn->spare = req;
+      pthread_mutex_unlock(&conn->lock);
+      break;
+    }
+    req->received = nowNanos();
+    req->op = req->body[0];
+    req->next = NULL;
+    // queue first, so the writer waits for this request in its turn; the
+    // extra count is held until every item is submitted
+    atomic_init(&req->remaining, 1);
+    pthread_mutex_lock(&conn->lock);
+    if (conn->tail != NULL)
+      conn->tail->next = req;
+    else
+      conn->head = req;
+    conn->tail = req;
+    conn->inflight++;
+    pthread_mutex_unlock(&conn->lock);
+    serverStartRequest(conn->server, req);
+  }
+  pthread_mutex_lock(&conn->lock);
+  conn->readDone = true;
+  pthread_cond_broadcast(&conn->changed);
+  pthread_mutex_unlock(&conn->lock);
+  return NULL;
+}
+
+// takes a server and an output buffer
+// appends the counters as one line of key=value pairs; latency_us lists
+// the non-empty buckets as ltN:count, N the bound in microseconds
+static void formatServerStats(Server *server, OutputBuffer *out) {
+  struct {
+    const char *key;
+    unsigned long long value;
+  } fields[] = {
+      {"connections", atomic_load(&server->accepted)},
+      {"requests", atomic_load(&server->requests)},
+      {"puzzles", atomic_load(&server->puzzles)},
+      {"inflight_requests", atomic_load(&server->inflightRequests)},
+      {"inflight_puzzles", atomic_load(&server->inflightPuzzles)},
+      {"peak_inflight_puzzles", atomic_load(&server->peakInflightPuzzles)},
+      {"pool_queued", threadPoolQueued(server->itemCtx.pool)},
+  };
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    outputString(out, fields[i].key);
+    outputChar(out, '=');
+    outputNumber(out, fields[i].value);
+    outputChar(out, ' ');
+  }
+  outputString(out, "latency_us=");
+  bool first = true;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    unsigned long long count = atomic_load(&server->latency[i]);
+    if (count == 0)
+      continue;
+    if (!first)
+      outputChar(out, ',');
+    first = false;
+    outputString(out, "lt");
+    outputNumber(out, 1UL << i);
+    outputChar(out, ':');
+    outputNumber(out, count);
+  }
+  outputChar(out, '\n');
+}
+
+// takes a server, a request whose items have all been checked and a buffer
+// appends the response frame of the request
+static void formatResponse(Server *server, Request *req, OutputBuffer *out) {
+  size_t start = out->size;
+  outputBytes(out, "\0\0\0\0", 4); // the length, filled in below
+  outputChar(out, req->status == PARSE_OK ? 0 : 1);
+  if (req->op == 'q')
+    formatServerStats(server, out);
+  for (int i = 0; i < req->count; i++)
+    formatBatchItem(out, &req->items[i].item);
+  if (req->status != PARSE_OK)
+    outputString(out, req->error);
+  uint32_t length = (uint32_t)(out->size - start - 4);
+  for (int i = 0; i < 4; i++)
+    out->data[start + i] = (char)(length >> (8 * i));
+}
+
+// adds the time since each request was received to the histogram
+static void serverRecordLatency(Server *server, const uint64_t *received,
+                                int count) {
+  uint64_t now = nowNanos();
+  for (int i = 0; i < count; i++) {
+    uint64_t us = (now - received[i]) / 1000;
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= LATENCY_BUCKETS)
+      bucket = LATENCY_BUCKETS - 1;
+    atomic_fetch_add_explicit(&server->latency[bucket], 1,
+                              memory_order_relaxed);
+  }
+}
+
+// closes the socket of conn and frees it, taking it off the server's list
+static void closeConnection(Connection *conn) {
+  Server *server = conn->server;
+  close(conn->fd);
+  pthread_mutex_destroy(&conn->lock);
+  pthread_cond_destroy(&conn->changed);
+  free(conn->in);
+  pthread_mutex_lock(&server->lock);
+  Connection **link = &server->connections;
+  while (*link != conn)
+    link = &(*link)->next;
+  *link = conn->next;
+  if (server->connections == NULL)
+    pthread_cond_broadcast(&server->idle);
+  pthread_mutex_unlock(&server->lock);
+  free(conn);
+}
+
+// Thread function serving one connection. It starts the reader and then
+// writes responses: every request that is ready goes into one buffer, sent
+// once the next request is not ready yet. Ends, closing the socket, when
+// the reader has stopped and every request is answered.
+static void *serverConnection(void *param) {
+  Connection *conn = (Connection *)param;
+  Server *server = conn->server;
+  if (pthread_create(&conn->reader, NULL, serverReader, conn) != 0)
+    conn->readDone = true;
+  bool readerStarted = !conn->readDone;
+  OutputBuffer out;
+  outputInit(&out, -1);
+  uint64_t received[SERVER_MAX_INFLIGHT];
+  int answered = 0;
+  bool sending = true;
+  pthread_mutex_lock(&conn->lock);
+  while (true) {
+    Request *req = conn->head;
+    if (req != NULL && atomic_load(&req->remaining) == 0 &&
+        answered < SERVER_MAX_INFLIGHT && out.size < OUTPUT_FLUSH_SIZE) {
+      conn->head = req->next;
+      if (conn->head == NULL)
+        conn->tail = NULL;
+      pthread_mutex_unlock(&conn->lock);
+      formatResponse(server, req, &out);
+      received[answered++] = req->received;
+      atomic_fetch_sub(&server->inflightRequests, 1);
+      atomic_fetch_sub(&server->inflightPuzzles, req->count);
+      arenaRelease(&req->grids, (ArenaMark){NULL, 0});
+      pthread_mutex_lock(&conn->lock);
+      req->next = conn->spare;
+      conn->spare = req;
+      conn->inflight--;
+      pthread_cond_broadcast(&conn->changed);
+      continue;
+    }
+    if (answered > 0) {
+      pthread_mutex_unlock(&conn->lock);
+      if (sending && !sendFully(conn->fd, out.data, out.size)) {
+        // the client is gone: stop reading, and drop what is left
+        sending = false;
+        shutdown(conn->fd, SHUT_RD);
+      }
+      serverRecordLatency(server, received, answered);
+      out.size = 0;
+      answered = 0;
+      pthread_mutex_lock(&conn->lock);
+      continue;
+    }
+    if (req == NULL && conn->readDone)
+      break;
+    pthread_cond_wait(&conn->changed, &conn->lock);
+  }
+  pthread_mutex_unlock(&conn->lock);
+  if (readerStarted)
+    pthread_join(conn->reader, NULL);
+  outputFree(&out);
+  while (conn->spare != NULL) {
+    Request *req = conn->spare;
+    conn->spare = req->next;
+    arenaDestroy(&req->grids);
+    free(req->items);
+    free(req->body);
+    free(req);
+  }
+  closeConnection(conn);
+  return NULL;
+}
+
+// takes a server and an accepted socket
+// starts serving the connection on a thread of its own
+static void serverAccept(Server *server, int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // TCP only
+  Connection *conn = calloc(1, sizeof(Connection));
+  conn->server = server;
+  conn->fd = fd;
+  conn->in = malloc(SERVER_READ_SIZE);
+  pthread_mutex_init(&conn->lock, NULL);
+  pthread_cond_init(&conn->changed, NULL);
+  pthread_mutex_lock(&server->lock);
+  conn->next = server->connections;
+  server->connections = conn;
+  pthread_mutex_unlock(&server->lock);
+  atomic_fetch_add(&server->accepted, 1);
+  pthread_t thread;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&thread, &attr, serverConnection, conn) != 0)
+    closeConnection(conn);
+  pthread_attr_destroy(&attr);
+}
+
+// takes an address, "unix:PATH" or "tcp:[HOST:]PORT" (HOST defaults to
+// 127.0.0.1), and the server to set up
+// returns false, after printing why, if it cannot be listened on
+static bool serverListen(const char *address, Server *server) {
+  int fd = -1;
+  server->unixPath = NULL;
+  if (strncmp(address, "unix:", 5) == 0) {
+    const char *path = address + 5;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) == 0 || strlen(path) >= sizeof(addr.sun_path)) {
+      printf("Bad socket path %s\n", path);
+      return false;
+    }
+    strcpy(addr.sun_path, path);
+    // a socket file left by an earlier run would make bind fail
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+      server->unixPath = path;
+    else if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  } else if (strncmp(address, "tcp:", 4) == 0) {
+    char host[256] = "127.0.0.1";
+    const char *port = address + 4;
+    const char *colon = strrchr(port, ':');
+    if (colon != NULL) {
+      size_t length = colon - port;
+      if (length >= sizeof(host)) {
+        printf("Bad host in %s\n", address);
+        return false;
+      }
+      memcpy(host, port, length);
+      host[length] = '\0';
+      port = colon + 1;
+    }
+    struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                             .ai_socktype = SOCK_STREAM,
+                             .ai_flags = AI_PASSIVE};
+    struct addrinfo *res;
+    int rc = getaddrinfo(host, port, &hints, &res);
+    if (rc != 0) {
+      printf("Could not resolve %s: %s\n", address, gai_strerror(rc));
+      return false;
+    }
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    int one = 1;
+    if (fd >= 0 &&
+        (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+         bind(fd, res->ai_addr, res->ai_addrlen) != 0)) {
+      close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(res);
+  } else {
+    printf("Listen address must be unix:PATH or tcp:[HOST:]PORT\n");
+    return false;
+  }
+  if (fd >= 0 && listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0) {
+    printf("Could not listen on %s: %s\n", address, strerror(errno));
+    if (server->unixPath != NULL)
+      unlink(server->unixPath);
+    return false;
+  }
+  server->listenFd = fd;
+  return true;
+}
+
+// Thread function waiting for a stop signal, which it passes on to the
+// accept loop through the wake pipe.
+static void *serverSignals(void *param) {
+  Server *server = (Server *)param;
+  int sig;
+  sigwait(&server->signals, &sig);
+  char byte = 0;
+  while (write(server->wake[1], &byte, 1) < 0 && errno == EINTR)
+    ;
+  return NULL;
+}
+
+// sets signals to the ones that stop the server and blocks them on the
+// calling thread. Threads started afterwards, the pool's included, inherit
+// the mask, so the signals reach only the server's sigwait.
+static void blockServerSignals(sigset_t *signals) {
+  sigemptyset(signals);
+  sigaddset(signals, SIGINT);
+  sigaddset(signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, signals, NULL);
+}
+
+// takes a listen address, a context with a pool, an output mode and the
+// stop signals, already blocked
+// accepts connections and answers their requests until SIGINT or SIGTERM,
+// then lets every connection finish what it has read. Puzzles are checked
+// one per worker as in batch mode. With ctx->stats the server's counters
+// are printed on stderr at the end.
+// returns false if the address could not be listened on
+bool runServer(const char *address, const SudokuContext *ctx,
+               OutputMode mode, const sigset_t *signals) {
+  Server *server = calloc(1, sizeof(Server));
+  server->itemCtx = *ctx;
+  if (server->itemCtx.threads == THREADS_AUTO)
+    server->itemCtx.threads = THREADS_INLINE;
+  // items run on the pool's workers, or on reader threads without a pool
+  server->itemCtx.scratch = NULL;
+  server->mode = mode;
+  server->signals = *signals;
+  if (!serverListen(address, server) || pipe(server->wake) != 0) {
+    free(server);
+    return false;
+  }
+  pthread_mutex_init(&server->lock, NULL);
+  pthread_cond_init(&server->idle, NULL);
+  pthread_t signalThread;
+  bool waitingForSignal =
+      pthread_create(&signalThread, NULL, serverSignals, server) == 0;
+  struct pollfd fds[2] = {{server->listenFd, POLLIN, 0},
+                          {server->wake[0], POLLIN, 0}};
+  while (waitingForSignal) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents != 0) {
+      pthread_join(signalThread, NULL);
+      waitingForSignal = false;
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(server->listenFd, NULL, NULL);
+      if (fd >= 0)
+        serverAccept(server, fd);
+    }
+  }
+  if (waitingForSignal) {
+    pthread_kill(signalThread, SIGTERM);
+    pthread_join(signalThread, NULL);
+  }
+  close(server->listenFd);
+  if (server->unixPath != NULL)
+    unlink(server->unixPath);
+  // stop every reader; writers answer what was read, then close
+  pthread_mutex_lock(&server->lock);
+  for (Connection *conn = server->connections; conn != NULL; conn = conn->next)
+    shutdown(conn->fd, SHUT_RD);
+  while (server->connections != NULL)
+    pthread_cond_wait(&server->idle, &server->lock);
+  pthread_mutex_unlock(&server->lock);
+  threadPoolWait(server->itemCtx.pool, &server->group);
+  if (ctx->stats != NULL) {
+    OutputBuffer out;
+    outputInit(&out, STDERR_FILENO);
+    outputString(&out, "server ");
+    formatServerStats(server, &out);
+    outputFlush(&out);
+    outputFree(&out);
+  }
+  close(server->wake[0]);
+  close(server->wake[1]);
+  pthread_mutex_destroy(&server->lock);
+  pthread_cond_destroy(&server->idle);
+  free(server);
+  return true;
+}
+
+// takes a context holding only settings
+// starts the worker pool and creates the caches and the scratch arena
+// shared by every check of the run, with a result cache of cacheEntries
+// if that is positive
+// returns false if the pool could not be started
+static bool openContext(SudokuContext *ctx, int cacheEntries) {
+  ctx->pool = threadPoolCreate(0);
+  ctx->tables = createRegionTableCache();
+  ctx->matrices = createDlxCache();
+  ctx->results = createResultCache(cacheEntries);
+  ctx->scratch = calloc(1, sizeof(Arena));
+  return ctx->pool != NULL;
+}
+
+// releases what openContext created
+static void closeContext(SudokuContext *ctx) {
+  threadPoolDestroy(ctx->pool);
+  deleteRegionTableCache(ctx->tables);
+  deleteDlxCache(ctx->matrices);
+  deleteResultCache(ctx->results);
+  arenaDestroy(ctx->scratch);
+  free(ctx->scratch);
+  ctx->pool = NULL;
+  ctx->tables = NULL;
+  ctx->matrices = NULL;
+  ctx->results = NULL;
+  ctx->scratch = NULL;
+}
+
+// expects file name of the puzzle as argument in command line, or
+// --batch [--solve] [file] to check a stream of puzzles from file or stdin.
+// --threads=auto|inline|chunked|fanout pins how regions use the pool.
+// --to-binary puzzles.txt corpus.bin converts text puzzles to the packed
+// binary format, which every mode also accepts as input.
+// --bench [--sizes=4,9,...] [--count=N] [--seed=S] [corpus...] times the
+// phases of checking generated puzzles, or the given corpora.
+// --generate=N [--sizes=9,...] [--clues=K|--holes=F] [--unique]
+// [--invalid=F] [--seed=S] [out] writes N seeded puzzles per size, with
+// K clues or a fraction F of cells emptied, optionally only with a unique
+// solution, and a fraction of them given a duplicate.
+// --stats prints counters and phase timers on stderr at the end of a run.
+// --solutions=K counts the ways to complete each puzzle, up to K, and
+// --unique is --solutions=2: 0, 1 or 2+ solutions.
+// --engine=bitmask|dlx picks the search used to solve puzzles.
+// --cache=N reuses the results of up to N checks for puzzles equal to
+// earlier ones up to relabeling, row and column moves and transposition.
+// --edit puzzle.txt applies cell edits read from stdin, reporting
+// validity and conflicts after each.
+// --output=text|verdict|binary picks what is written per puzzle; binary
+// is for batches and the server only.
+// --serve=unix:PATH|tcp:[HOST:]PORT answers framed requests on a socket
+// until SIGINT or SIGTERM.
+int main(int argc, char **argv) {
+  if (argc == 4 && strcmp(argv[1], "--to-binary") == 0)
+    return convertToBinary(argv[2], argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+  bool batch = false;
+  bool solve = false;
+  bool bench = false;
+  bool edit = false;
+  const char *serveAddress = NULL;
+  const char *benchSizeList = NULL;
+  int benchCount = 200;
+  uint64_t seed = 1;
+  int cacheEntries = 0;  // result cache size, if > 0
+  int generateCount = 0; // puzzles per size to generate, if > 0
+  GeneratorSpec spec = {.clues = -1, .holes = -1};
+  long solutionLimit = 0; // count solutions instead of checking, if > 0
+  OutputMode outputMode = OUTPUT_TEXT;
+  char *filename = NULL;
+  char **files = calloc(argc, sizeof(char *)); // every non-option argument
+  int nfiles = 0;
+  bool usageError = false;
+  SudokuContext ctx = {.threads = THREADS_AUTO, .engine = ENGINE_BITMASK};
+  SudokuStats stats = {0};
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--batch") == 0)
+      batch = true;
+    else if (strcmp(argv[i], "--edit") == 0)
+      edit = true;
+    else if (strcmp(argv[i], "--bench") == 0)
+      bench = true;
+    else if (strncmp(argv[i], "--serve=", 8) == 0)
+      serveAddress = argv[i] + 8;
+    else if (strncmp(argv[i], "--sizes=", 8) == 0)
+      benchSizeList = argv[i] + 8;
+    else if (strncmp(argv[i], "--count=", 8) == 0)
+      usageError |= (benchCount = atoi(argv[i] + 8)) <= 0;
+    else if (strncmp(argv[i], "--seed=", 7) == 0)
+      seed = strtoull(argv[i] + 7, NULL, 10);
+    else if (strncmp(argv[i], "--generate=", 11) == 0)
+      usageError |= (generateCount = atoi(argv[i] + 11)) <= 0;
+    else if (strncmp(argv[i], "--cache=", 8) == 0)
+      usageError |= (cacheEntries = atoi(argv[i] + 8)) <= 0;
+    else if (strncmp(argv[i], "--clues=", 8) == 0)
+      usageError |= (spec.clues = atoi(argv[i] + 8)) < 0;
+    else if (strncmp(argv[i], "--holes=", 8) == 0)
+      usageError |=
+          !((spec.holes = atof(argv[i] + 8)) >= 0 && spec.holes <= 1);
+    else if (strncmp(argv[i], "--invalid=", 10) == 0)
+      usageError |=
+          !((spec.invalid = atof(argv[i] + 10)) >= 0 && spec.invalid <= 1);
+    else if (strcmp(argv[i], "--unique") == 0)
+      solutionLimit = 2, spec.unique = true;
+    else if (strncmp(argv[i], "--solutions=", 12) == 0)
+      usageError |= (solutionLimit = atol(argv[i] + 12)) <= 0;
+    else if (strcmp(argv[i], "--output=text") == 0)
+      outputMode = OUTPUT_TEXT;
+    else if (strcmp(argv[i], "--output=verdict") == 0)
+      outputMode = OUTPUT_VERDICT;
+    else if (strcmp(argv[i], "--output=binary") == 0)
+      outputMode = OUTPUT_BINARY;
+    else if (strcmp(argv[i], "--solve") == 0)
+      solve = true;
+    else if (strcmp(argv[i], "--stats") == 0)
+      ctx.stats = &stats;
+    else if (strcmp(argv[i], "--engine=bitmask") == 0)
+      ctx.engine = ENGINE_BITMASK;
+    else if (strcmp(argv[i], "--engine=dlx") == 0)
+      ctx.engine = ENGINE_DLX;
+    else if (strncmp(argv[i], "--threads=", 10) == 0)
+      usageError |= !parseThreadPolicy(argv[i] + 10, &ctx.threads);
+    else if (argv[i][0] == '-' && argv[i][1] == '-')
+      usageError = true;
+    else
+      files[nfiles++] = argv[i];
+  }
+  filename = files[0];
+  if (generateCount > 0 && !usageError && !bench && !batch && !solve &&
+      !edit && serveAddress == NULL && nfiles <= 1 &&
+      outputMode != OUTPUT_VERDICT && (spec.clues < 0 || spec.holes < 0)) {
+    int rc = EXIT_FAILURE;
+    if (openContext(&ctx, 0) &&
+        runGenerator(benchSizeList, generateCount, spec, seed, outputMode,
+                     filename, &ctx))
+      rc = EXIT_SUCCESS;
+    else if (ctx.pool == NULL)
+      printf("Error: pthread_create failed\n");
+    closeContext(&ctx);
+    free(files);
+    if (ctx.stats != NULL)
+      printStats(ctx.stats);
+    return rc;
+  }
+  if (bench && !usageError && !batch && !solve && serveAddress == NULL) {
+    int rc = EXIT_FAILURE;
+    if (openContext(&ctx, 0))
+      rc = runBenchmark(benchSizeList, benchCount, seed, files, &ctx);
+    else
+      printf("Error: pthread_create failed\n");
+    closeContext(&ctx);
+    free(files);
+    return rc;
+  }
+  free(files);
+  if (usageError || bench || generateCount > 0 || nfiles > 1 ||
+      (solve && !batch) ||
+      (solutionLimit > 0 && solve) ||
+      (outputMode == OUTPUT_BINARY && !batch && serveAddress == NULL) ||
+      (edit && (batch || solutionLimit > 0)) ||
+      (serveAddress != NULL &&
+       (batch || edit || solve || solutionLimit > 0 || nfiles > 0)) ||
+      (!batch && serveAddress == NULL && filename == NULL)) {
+    printf("usage: ./sudoku [--threads=POLICY] [--stats] "
+           "[--output=text|verdict] puzzle.txt\n");
+    printf("       ./sudoku --batch [--solve] [--threads=POLICY] [--stats] "
+           "[--output=OUTPUT] [puzzles.txt|-]\n");
+    printf("       ./sudoku --solutions=K|--unique [--batch] [--engine=ENGINE] "
+           "[--threads=POLICY] [--stats] [puzzle.txt]\n");
+    printf("       ./sudoku --edit puzzle.txt < edits\n");
+    printf("       ./sudoku --serve=unix:PATH|tcp:[HOST:]PORT [--engine=ENGINE] "
+           "[--threads=POLICY] [--stats] [--output=OUTPUT]\n");
+    printf("       ./sudoku --to-binary puzzles.txt corpus.bin\n");
+    printf("       ./sudoku --bench [--sizes=4,9,...] [--count=N] "
+           "[--seed=S] [--threads=POLICY] [corpus...]\n");
+    printf("       ./sudoku --generate=N [--sizes=9,...] [--clues=K|--holes=F] "
+           "[--unique] [--invalid=F] [--seed=S] [--output=text|binary] "
+           "[out|-]\n");
+    printf("POLICY is auto, inline, chunked or fanout\n");
+    printf("OUTPUT is text, verdict or binary\n");
+    printf("--engine=bitmask|dlx picks the solver for --solve and "
+           "--solutions\n");
+    printf("--cache=N keeps up to N results of solving checks for "
+           "equivalent puzzles\n");
+    return EXIT_FAILURE;
+  }
+  // the pool's workers must start with the stop signals blocked
+  sigset_t signals;
+  if (serveAddress != NULL)
+    blockServerSignals(&signals);
+  // worker pool sized to the core count, shared by every checkPuzzle call
+  uint64_t start = STAT_START(ctx.stats);
+  if (!openContext(&ctx, cacheEntries)) {
+    printf("Error: pthread_create failed\n");
+    closeContext(&ctx);
+    return EXIT_FAILURE;
+  }
+  STAT_STOP(ctx.stats, poolNanos, start);
+  STAT_ADD(ctx.stats, threadsCreated, threadPoolSize(ctx.pool));
+  if (serveAddress != NULL) {
+    bool ok = runServer(serveAddress, &ctx, outputMode, &signals);
+    closeContext(&ctx);
+    if (ctx.stats != NULL)
+      printStats(ctx.stats);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (batch) {
+    PuzzleInput in;
+    if (!openPuzzleInput(filename, &in)) {
+      printf("Could not open file %s\n", filename);
+      exit(EXIT_FAILURE);
+    }
+    bool ok = runBatch(&in, &ctx, solve, solutionLimit, outputMode);
+    closePuzzleInput(&in);
+    closeContext(&ctx);
+    if (ctx.stats != NULL)
+      printStats(ctx.stats);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  // grid is a contiguous psize x psize block
+  SudokuGrid *grid = NULL;
+  // find grid size and fill grid
+  start = STAT_START(ctx.stats);
+  readSudokuPuzzle(filename, &grid);
+  STAT_STOP(ctx.stats, parseNanos, start);
+  STAT_ADD(ctx.stats, allocations, 2);
+  if (edit) {
+    closeContext(&ctx);
+    SudokuBoard *board = createSudokuBoard(grid);
+    deleteSudokuPuzzle(grid);
+    if (board == NULL) {
+      printf("Error: --edit needs a square puzzle size\n");
+      return EXIT_FAILURE;
+    }
+    bool ok = runEdits(board);
+    deleteSudokuBoard(board);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (solutionLimit > 0) {
+    start = STAT_START(ctx.stats);
+    long count = countSolutions(&ctx, grid, solutionLimit);
+    STAT_STOP(ctx.stats, solveNanos, start);
+    closeContext(&ctx);
+    OutputBuffer out;
+    fflush(stdout);
+    outputInit(&out, STDOUT_FILENO);
+    outputString(&out, "Solutions: ");
+    formatSolutionCount(&out, count, solutionLimit);
+    outputChar(&out, '\n');
+    outputFlush(&out);
+    outputFree(&out);
+    deleteSudokuPuzzle(grid);
+    if (ctx.stats != NULL)
+      printStats(ctx.stats);
+    return count < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+  bool valid = false;
+  bool complete = false;
+  checkPuzzle(&ctx, grid, &complete, &valid);
+  closeContext(&ctx);
+  start = STAT_START(ctx.stats);
+  OutputBuffer out;
+  fflush(stdout);
+  outputInit(&out, STDOUT_FILENO);
+  outputString(&out, "Complete puzzle? ");
+  outputString(&out, complete ? "true\n" : "false\n");
+  if (complete) {
+    outputString(&out, "Valid puzzle? ");
+    outputString(&out, valid ? "true\n" : "false\n");
+  }
+  if (outputMode == OUTPUT_TEXT)
+    printSudokuPuzzle(&out, grid);
+  outputFlush(&out);
+  outputFree(&out);
+  STAT_STOP(ctx.stats, printNanos, start);
+  deleteSudokuPuzzle(grid);
+  if (ctx.stats != NULL)
+    printStats(ctx.stats);
+  return EXIT_SUCCESS;
+}
@@ -1,188 +1,1907 @@
-// Sudoku puzzle verifier and solver
+// Sudoku puzzle verifier and solver library; the API is in sudoku.h
 
 #include <assert.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-// Structure for passing data to threads.
+#include "sudoku.h"
+
+// One block of an arena; blocks are chained from the newest down.
+struct ArenaBlock {
+  struct ArenaBlock *prev; // older block, or NULL
+  size_t size;             // bytes in data
+  size_t used;
+  max_align_t data[];
+};
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+static ArenaBlock *arenaNewBlock(ArenaBlock *prev, size_t size) {
+  ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+  block->prev = prev;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+// takes an alignment that is a power of two
+// returns bytes of uninitialized memory at that alignment, valid until the
+// arena is released to a mark taken before this call
+void *arenaAllocAligned(Arena *arena, size_t bytes, size_t align) {
+  ArenaBlock *block = arena->top;
+  size_t pad = 0;
+  if (block != NULL)
+    pad = -(uintptr_t)((char *)block->data + block->used) & (align - 1);
+  if (block == NULL || block->size - block->used < pad + bytes) {
+    size_t size = block == NULL ? ARENA_BLOCK_SIZE : 2 * block->size;
+    if (size < bytes + align)
+      size = bytes + align;
+    block = arena->top = arenaNewBlock(block, size);
+    pad = -(uintptr_t)block->data & (align - 1);
+  }
+  void *p = (char *)block->data + block->used + pad;
+  block->used += pad + bytes;
+  return p;
+}
+
+// as arenaAllocAligned, aligned for any type
+void *arenaAlloc(Arena *arena, size_t bytes) {
+  return arenaAllocAligned(arena, bytes, sizeof(max_align_t));
+}
+
+// as arenaAlloc, with the memory zeroed
+void *arenaCalloc(Arena *arena, size_t count, size_t size) {
+  void *p = arenaAlloc(arena, count * size);
+  memset(p, 0, count * size);
+  return p;
+}
+
+ArenaMark arenaMark(const Arena *arena) {
+  return (ArenaMark){arena->top, arena->top == NULL ? 0 : arena->top->used};
+}
+
+// frees everything allocated since mark was taken. When that empties an
+// arena that had outgrown its first block, the blocks are merged into one,
+// so the next puzzle of the same size is served without calling malloc.
+void arenaRelease(Arena *arena, ArenaMark mark) {
+  // a mark taken before the first allocation stands for the bottom block
+  size_t freed = 0;
+  while (arena->top != NULL && arena->top != mark.block &&
+         !(mark.block == NULL && arena->top->prev == NULL)) {
+    ArenaBlock *block = arena->top;
+    arena->top = block->prev;
+    freed += block->size;
+    free(block);
+  }
+  if (arena->top == NULL)
+    return;
+  arena->top->used = mark.block == NULL ? 0 : mark.used;
+  if (freed > 0 && arena->top->prev == NULL && arena->top->used == 0) {
+    size_t size = freed + arena->top->size;
+    free(arena->top);
+    arena->top = arenaNewBlock(NULL, size);
+  }
+}
+
+// frees every block of the arena
+void arenaDestroy(Arena *arena) {
+  while (arena->top != NULL) {
+    ArenaBlock *block = arena->top;
+    arena->top = block->prev;
+    free(block);
+  }
+}
+
+// takes an arena, or NULL for the heap, and puzzle size
+// returns an empty (all 0) grid; heap grids are released with
+// deleteSudokuPuzzle, arena grids with the arena
+SudokuGrid *arenaCreateGrid(Arena *arena, int psize) {
+  size_t bytes = (size_t)psize * psize * gridCellBytes(psize);
+  SudokuGrid *grid;
+  if (arena == NULL) {
+    grid = malloc(sizeof(SudokuGrid));
+    grid->cells = calloc(bytes, 1);
+  } else {
+    grid = arenaAlloc(arena, sizeof(SudokuGrid));
+    grid->cells = arenaCalloc(arena, bytes, 1);
+  }
+  grid->psize = psize;
+  grid->cellBytes = gridCellBytes(psize);
+  return grid;
+}
+
+// takes puzzle size
+// returns an empty (all 0) grid, to be released with deleteSudokuPuzzle
+SudokuGrid *createSudokuGrid(int psize) {
+  return arenaCreateGrid(NULL, psize);
+}
+
+// takes a grid
+// returns a new grid with the same cells
+SudokuGrid *copySudokuGrid(const SudokuGrid *grid) {
+  SudokuGrid *copy = createSudokuGrid(grid->psize);
+  memcpy(copy->cells, grid->cells,
+         (size_t)grid->psize * grid->psize * grid->cellBytes);
+  return copy;
+}
+
+// takes a grid
+// frees the memory allocated
+void deleteSudokuPuzzle(SudokuGrid *grid) {
+  free(grid->cells);
+  free(grid);
+}
+
+// Size of a cache line; results written by different workers are kept
+// this far apart so that one worker's write does not evict another's line.
+#define CACHE_LINE 64
+
+// Read-only facts about the puzzle being validated, set up once and
+// shared by all of its region checks instead of copied into each one.
+typedef struct {
+  const SudokuGrid *grid; // Pointer to the sudoku grid.
+  int psize;     // Puzzle size (e.g., 9 for a 9x9 puzzle)
+  int n;         // Subgrid dimension, i.e. n = sqrt(psize)
+  atomic_bool *stop; // Set once any region is invalid.
+} PuzzleInfo;
+
+// Structure for passing data to threads. Each one fills a cache line of
+// its own, since the worker checking the region writes valid into it.
 typedef struct {
-  int type;      // 0 = row check, 1 = column check, 2 = subgrid check
+  _Alignas(CACHE_LINE) int type; // 0 = row, 1 = column, 2 = subgrid check
   int index;     // For row/column: the row or column number (1-indexed)
   int startRow;  // For subgrid: top-left row (1-indexed)
   int startCol;  // For subgrid: top-left column (1-indexed)
-  int psize;     // Puzzle size (e.g., 9 for a 9x9 puzzle)
-  int n;         // Subgrid dimension, i.e. n = sqrt(psize)
   int valid;     // Result: 1 if region is valid, 0 otherwise.
-  int **grid;    // Pointer to the sudoku grid.
+  const PuzzleInfo *puzzle; // Shared by every region of the puzzle.
 } ThreadData;
 
-// Thread function to validate one region of the sudoku puzzle.
-void *validateRegion(void *param) {
-  ThreadData *data = (ThreadData *)param;
-  int psize = data->psize;
-  int *found = calloc(psize + 1, sizeof(int)); // indices 1..psize; index 0 is unused
-  if (data->type == 0) {
-    // Validate a row. data->index holds the row number.
-    int row = data->index;
-    for (int col = 1; col <= psize; col++) {
-      int num = data->grid[row][col];
-      if (num < 1 || num > psize) {
-        data->valid = 0;
-        free(found);
-        pthread_exit(NULL);
-      }
-      if (found[num] == 1) {
-        data->valid = 0;
-        free(found);
-        pthread_exit(NULL);
+typedef struct {
+  TaskFn fn;
+  void *arg;
+  TaskGroup *group;
+} Task;
+
+// Per-worker double-ended queue. The owner pushes and pops at the bottom,
+// so it works depth-first on what it submitted itself; idle threads steal
+// from the top, taking the oldest and usually largest work.
+typedef struct {
+  pthread_mutex_t lock;
+  Task *tasks; // circular buffer; top is tasks[head]
+  int capacity;
+  int head;
+  int count;
+} TaskDeque;
+
+// Tasks submitted from a worker go on its own deque; tasks from any other
+// thread are dealt round-robin over the workers' deques. Each worker finds
+// its deque through the pool's own thread-specific key, so pools know
+// nothing of each other.
+struct ThreadPool {
+  TaskDeque *deques; // one per worker
+  Arena *arenas;     // scratch memory of each worker
+  pthread_t *workers;
+  int nworkers;
+  int started;       // workers whose thread is running
+  pthread_key_t self; // deque index + 1 on a worker thread, else unset
+  atomic_int queued;   // tasks in all deques
+  atomic_int sleepers; // threads waiting on wake
+  atomic_uint nextDeque; // round-robin target for outside submissions
+  atomic_bool shutdown;
+  pthread_mutex_t sleepLock;
+  pthread_cond_t wake; // broadcast on new work, group completion, shutdown
+};
+
+// returns the deque index of the calling thread in pool, or -1 if it is
+// not one of pool's workers
+static inline int threadPoolSelf(const ThreadPool *pool) {
+  return (int)(intptr_t)pthread_getspecific(pool->self) - 1;
+}
+
+// returns number of online cores, at least 1
+int numCores(void) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores < 1 ? 1 : (int)cores;
+}
+
+static void dequePushBottom(TaskDeque *deque, Task task) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count == deque->capacity) {
+    // grow and unwrap the circular buffer
+    Task *tasks = malloc(2 * deque->capacity * sizeof(Task));
+    for (int i = 0; i < deque->count; i++)
+      tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+    free(deque->tasks);
+    deque->tasks = tasks;
+    deque->head = 0;
+    deque->capacity *= 2;
+  }
+  deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+  deque->count++;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+// takes a task from the bottom (owner) or top (thief) of deque
+static bool dequePop(TaskDeque *deque, bool bottom, Task *task) {
+  bool found = false;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count > 0) {
+    if (bottom) {
+      *task = deque->tasks[(deque->head + deque->count - 1) % deque->capacity];
+    } else {
+      *task = deque->tasks[deque->head];
+      deque->head = (deque->head + 1) % deque->capacity;
+    }
+    deque->count--;
+    found = true;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+// finds work for the calling thread: its own deque first, then the others
+static bool threadPoolFind(ThreadPool *pool, Task *task) {
+  if (atomic_load(&pool->queued) == 0)
+    return false;
+  int self = threadPoolSelf(pool);
+  if (self >= 0 && dequePop(&pool->deques[self], true, task))
+    goto found;
+  for (int i = 1; i <= pool->nworkers; i++) {
+    int victim = (self + i + pool->nworkers) % pool->nworkers;
+    if (victim != self && dequePop(&pool->deques[victim], false, task))
+      goto found;
+  }
+  return false;
+found:
+  atomic_fetch_sub(&pool->queued, 1);
+  return true;
+}
+
+static void threadPoolWakeAll(ThreadPool *pool) {
+  pthread_mutex_lock(&pool->sleepLock);
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->sleepLock);
+}
+
+// runs a task and marks it done in its group
+static void threadPoolRun(ThreadPool *pool, Task task) {
+  task.fn(task.arg);
+  if (atomic_fetch_sub(&task.group->pending, 1) == 1 &&
+      atomic_load(&pool->sleepers) > 0)
+    threadPoolWakeAll(pool);
+}
+
+// sleeps until woken, unless done() already holds; done is checked under
+// the lock, so a wake-up between the check and the wait is not lost
+static void threadPoolSleep(ThreadPool *pool, TaskGroup *group) {
+  pthread_mutex_lock(&pool->sleepLock);
+  atomic_fetch_add(&pool->sleepers, 1);
+  while (atomic_load(&pool->queued) == 0 && !atomic_load(&pool->shutdown) &&
+         (group == NULL || atomic_load(&group->pending) > 0))
+    pthread_cond_wait(&pool->wake, &pool->sleepLock);
+  atomic_fetch_sub(&pool->sleepers, 1);
+  pthread_mutex_unlock(&pool->sleepLock);
+}
+
+typedef struct {
+  ThreadPool *pool;
+  int index;
+} WorkerStart;
+
+static void *threadPoolWorker(void *param) {
+  WorkerStart start = *(WorkerStart *)param;
+  free(param);
+  ThreadPool *pool = start.pool;
+  pthread_setspecific(pool->self, (void *)(intptr_t)(start.index + 1));
+  Task task;
+  while (true) {
+    if (threadPoolFind(pool, &task))
+      threadPoolRun(pool, task);
+    else if (atomic_load(&pool->shutdown))
+      break;
+    else
+      threadPoolSleep(pool, NULL);
+  }
+  return NULL;
+}
+
+// takes number of workers, 0 meaning one per core
+// returns a running pool, to be released with threadPoolDestroy, or NULL
+// if the worker threads could not be started
+ThreadPool *threadPoolCreate(int nworkers) {
+  if (nworkers <= 0)
+    nworkers = numCores();
+  ThreadPool *pool = malloc(sizeof(ThreadPool));
+  if (pthread_key_create(&pool->self, NULL) != 0) {
+    free(pool);
+    return NULL;
+  }
+  pool->nworkers = nworkers;
+  pool->started = 0;
+  pool->deques = malloc(nworkers * sizeof(TaskDeque));
+  pool->arenas = calloc(nworkers, sizeof(Arena));
+  for (int i = 0; i < nworkers; i++) {
+    TaskDeque *deque = &pool->deques[i];
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->capacity = 64;
+    deque->tasks = malloc(deque->capacity * sizeof(Task));
+    deque->head = 0;
+    deque->count = 0;
+  }
+  atomic_init(&pool->queued, 0);
+  atomic_init(&pool->sleepers, 0);
+  atomic_init(&pool->nextDeque, 0);
+  atomic_init(&pool->shutdown, false);
+  pthread_mutex_init(&pool->sleepLock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pool->workers = malloc(nworkers * sizeof(pthread_t));
+  for (int i = 0; i < nworkers; i++) {
+    WorkerStart *start = malloc(sizeof(WorkerStart));
+    *start = (WorkerStart){pool, i};
+    if (pthread_create(&pool->workers[i], NULL, threadPoolWorker, start)) {
+      free(start);
+      threadPoolDestroy(pool);
+      return NULL;
+    }
+    pool->started++;
+  }
+  return pool;
+}
+
+// queues fn(arg) as part of group; with no pool the task runs immediately
+void threadPoolSubmit(ThreadPool *pool, TaskGroup *group, TaskFn fn,
+                      void *arg) {
+  if (pool == NULL) {
+    fn(arg);
+    return;
+  }
+  atomic_fetch_add(&group->pending, 1);
+  int target = threadPoolSelf(pool);
+  if (target < 0)
+    target = (int)(atomic_fetch_add(&pool->nextDeque, 1) %
+                   (unsigned)pool->nworkers);
+  dequePushBottom(&pool->deques[target], (Task){fn, arg, group});
+  atomic_fetch_add(&pool->queued, 1);
+  if (atomic_load(&pool->sleepers) > 0)
+    threadPoolWakeAll(pool);
+}
+
+// returns the index of the calling thread among pool's workers, or -1 if
+// it is not one of them
+int threadPoolCurrentWorker(const ThreadPool *pool) {
+  return pool == NULL ? -1 : threadPoolSelf(pool);
+}
+
+// returns the number of workers of pool, 0 for no pool
+int threadPoolSize(const ThreadPool *pool) {
+  return pool == NULL ? 0 : pool->nworkers;
+}
+
+// returns the number of tasks queued in pool and not yet started
+int threadPoolQueued(ThreadPool *pool) {
+  return pool == NULL ? 0 : atomic_load(&pool->queued);
+}
+
+// returns the scratch arena of the calling thread if it is one of pool's
+// workers, else NULL
+static Arena *threadPoolArena(const ThreadPool *pool) {
+  int self = threadPoolCurrentWorker(pool);
+  return self < 0 ? NULL : &pool->arenas[self];
+}
+
+// blocks until every task in group has finished. The caller runs queued
+// tasks while it waits, so waiting from inside a task cannot deadlock.
+void threadPoolWait(ThreadPool *pool, TaskGroup *group) {
+  if (pool == NULL)
+    return;
+  Task task;
+  while (atomic_load(&group->pending) > 0) {
+    if (threadPoolFind(pool, &task))
+      threadPoolRun(pool, task);
+    else
+      threadPoolSleep(pool, group);
+  }
+}
+
+// finishes queued work, joins the workers and frees the pool
+void threadPoolDestroy(ThreadPool *pool) {
+  if (pool == NULL)
+    return;
+  atomic_store(&pool->shutdown, true);
+  threadPoolWakeAll(pool);
+  for (int i = 0; i < pool->started; i++)
+    pthread_join(pool->workers[i], NULL);
+  for (int i = 0; i < pool->nworkers; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].tasks);
+    arenaDestroy(&pool->arenas[i]);
+  }
+  pthread_key_delete(pool->self);
+  pthread_mutex_destroy(&pool->sleepLock);
+  pthread_cond_destroy(&pool->wake);
+  free(pool->deques);
+  free(pool->arenas);
+  free(pool->workers);
+  free(pool);
+}
+
+// Boards with fewer cells than this are validated inline under
+// THREADS_AUTO; handing them to other threads costs more than the checks.
+#define INLINE_MAX_CELLS (64 * 64)
+
+// takes a context and puzzle size
+// returns the policy to use, never THREADS_AUTO
+ThreadPolicy chooseThreadPolicy(const SudokuContext *ctx, int psize) {
+  if (ctx == NULL || ctx->pool == NULL)
+    return THREADS_INLINE;
+  if (ctx->threads != THREADS_AUTO)
+    return ctx->threads;
+  if (ctx->pool->nworkers == 1 || psize * psize < INLINE_MAX_CELLS)
+    return THREADS_INLINE;
+  return THREADS_CHUNKED;
+}
+
+// takes a policy name as given on the command line
+// returns true and sets policy if the name is known
+bool parseThreadPolicy(const char *name, ThreadPolicy *policy) {
+  static const char *names[] = {"auto", "inline", "chunked", "fanout"};
+  for (int i = 0; i < 4; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *policy = (ThreadPolicy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Scratch memory for a call made with ctx. Fill, solve and verify take a
+// mark on entry and release it on return, so a pool worker reuses its own
+// arena for every puzzle it checks, and other threads ctx->scratch. With
+// neither, local (an empty arena of the caller's) is used, and the caller
+// destroys it before returning.
+static Arena *scratchArena(const SudokuContext *ctx, Arena *local) {
+  Arena *arena = ctx == NULL ? NULL : threadPoolArena(ctx->pool);
+  if (arena == NULL && ctx != NULL)
+    arena = ctx->scratch;
+  return arena == NULL ? local : arena;
+}
+
+// Number of 64-bit words needed for a bitset of the given size.
+#define BITSET_WORDS(bits) (((bits) + 63) / 64)
+
+// returns word w of the bitset holding bits 0..psize-1 all set
+static inline uint64_t fullMaskWord(int psize, int w) {
+  int bits = psize - 64 * w;
+  return bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+}
+
+// returns true if the region described by data holds 1..psize once each.
+// Each number sets bit num-1 of a mask; the region is valid when every
+// number is in range and the OR of all bits is the full mask, which with
+// psize cells means each number appears exactly once. Boards up to 64x64
+// use a single register; bigger ones use a multi-word bitset on the stack.
+static bool regionValid(const ThreadData *data) {
+  const SudokuGrid *grid = data->puzzle->grid;
+  int psize = data->puzzle->psize;
+  // every region is a rectangle of the grid: one row, one column or a box
+  int firstRow, firstCol, height, width;
+  if (data->type == 0) {
+    firstRow = data->index, firstCol = 1, height = 1, width = psize;
+  } else if (data->type == 1) {
+    firstRow = 1, firstCol = data->index, height = psize, width = 1;
+  } else {
+    firstRow = data->startRow, firstCol = data->startCol;
+    height = data->puzzle->n, width = data->puzzle->n;
+  }
+  unsigned usize = (unsigned)psize;
+  bool outOfRange = false;
+  if (psize <= 64) {
+    uint64_t seen = 0;
+    for (int row = firstRow; row < firstRow + height; row++) {
+      for (int col = firstCol; col < firstCol + width; col++) {
+        // 0 wraps around to out of range
+        unsigned bit = (unsigned)gridGet(grid, row, col) - 1;
+        outOfRange |= bit >= usize;
+        seen |= 1ULL << (bit & 63);
+      }
+    }
+    return !outOfRange && seen == fullMaskWord(psize, 0);
+  }
+  int words = BITSET_WORDS(psize);
+  uint64_t seen[words];
+  for (int w = 0; w < words; w++) seen[w] = 0;
+  for (int row = firstRow; row < firstRow + height && !outOfRange; row++) {
+    for (int col = firstCol; col < firstCol + width; col++) {
+      unsigned bit = (unsigned)gridGet(grid, row, col) - 1;
+      if (bit >= usize) {
+        outOfRange = true;
+        break;
+      }
+      seen[bit >> 6] |= 1ULL << (bit & 63);
+    }
+  }
+  bool full = !outOfRange;
+  for (int w = 0; w < words && full; w++)
+    full = seen[w] == fullMaskWord(psize, w);
+  return full;
+}
+
+// Thread function to validate one region of the sudoku puzzle.
+// Once another region of the puzzle has been found invalid the check is
+// skipped and the region is reported invalid too; the puzzle's verdict is
+// already known.
+static void *validateRegion(void *param) {
+  ThreadData *data = (ThreadData *)param;
+  atomic_bool *stop = data->puzzle->stop;
+  if (stop != NULL && atomic_load_explicit(stop, memory_order_relaxed)) {
+    data->valid = 0;
+    return NULL;
+  }
+  data->valid = regionValid(data);
+  if (!data->valid && stop != NULL)
+    atomic_store_explicit(stop, true, memory_order_relaxed);
+  return NULL;
+}
+
+// Largest board validated by the vector kernels: one 16-lane byte vector
+// holds a row, with each lane's number mapped to a 16-bit mask.
+#define SIMD_MAX_PSIZE 16
+
+// Scratch for the vector kernels. Every region of the board becomes one
+// lane of a layout: lane j of row r in byRow is cell (r, j), so OR-ing the
+// rows' bits lane by lane checks columns. byCol is the transpose, checking
+// rows, and byBox holds cell k of box b at row k, lane b, checking boxes.
+// Rows are padded to an even count for the two-row AVX2 loop by repeating
+// row 0, which leaves the OR unchanged.
+typedef struct {
+  uint8_t byRow[SIMD_MAX_PSIZE][16];
+  uint8_t byCol[SIMD_MAX_PSIZE][16];
+  uint8_t byBox[SIMD_MAX_PSIZE][16];
+} SimdLayouts;
+
+// Checks one layout: every lane below psize must see each number 1..psize.
+typedef bool (*SimdKernel)(const uint8_t (*layout)[16], int rows, int psize);
+
+// gathers the board into the three layouts; unused lanes hold 1
+static void simdGather(const SudokuGrid *grid, int n, SimdLayouts *lay) {
+  int psize = grid->psize;
+  const uint8_t *cells = grid->cells;
+  memset(lay, 1, sizeof(SimdLayouts));
+  for (int row = 0; row < psize; row++) {
+    for (int col = 0; col < psize; col++) {
+      uint8_t num = cells[row * psize + col];
+      lay->byRow[row][col] = num;
+      lay->byCol[col][row] = num;
+      int box = (row / n) * n + col / n;
+      lay->byBox[(row % n) * n + col % n][box] = num;
+    }
+  }
+  if (psize % 2 == 1 && psize < SIMD_MAX_PSIZE) {
+    memcpy(lay->byRow[psize], lay->byRow[0], 16);
+    memcpy(lay->byCol[psize], lay->byCol[0], 16);
+    memcpy(lay->byBox[psize], lay->byBox[0], 16);
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("ssse3"))) static bool
+simdKernelSsse3(const uint8_t (*layout)[16], int rows, int psize) {
+  // lane value v looks up bit v-1 in a low-byte and a high-byte table;
+  // 0 wraps to 255, which pshufb maps to no bits and the range check flags
+  const __m128i lutLo = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0,
+                                      0, 0, 0, 0, 0);
+  const __m128i lutHi = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16,
+                                      32, 64, -128);
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i limit = _mm_set1_epi8((char)(psize - 1));
+  __m128i lo = _mm_setzero_si128(), hi = lo;
+  __m128i inRange = _mm_set1_epi8(-1);
+  for (int r = 0; r < rows; r++) {
+    __m128i idx = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)layout[r]), one);
+    inRange = _mm_and_si128(
+        inRange, _mm_cmpeq_epi8(_mm_max_epu8(idx, limit), limit));
+    lo = _mm_or_si128(lo, _mm_shuffle_epi8(lutLo, idx));
+    hi = _mm_or_si128(hi, _mm_shuffle_epi8(lutHi, idx));
+  }
+  uint32_t full = (uint32_t)fullMaskWord(psize, 0);
+  __m128i ok = _mm_and_si128(
+      inRange, _mm_and_si128(_mm_cmpeq_epi8(lo, _mm_set1_epi8((char)full)),
+                             _mm_cmpeq_epi8(hi, _mm_set1_epi8((char)(full >> 8)))));
+  uint32_t lanes = (1u << psize) - 1;
+  return ((uint32_t)_mm_movemask_epi8(ok) & lanes) == lanes;
+}
+
+__attribute__((target("avx2"))) static bool
+simdKernelAvx2(const uint8_t (*layout)[16], int rows, int psize) {
+  // two rows per iteration, one in each 128-bit half
+  const __m256i lutLo = _mm256_setr_epi8(
+      1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+      1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i lutHi = _mm256_setr_epi8(
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128,
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, -128);
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i limit = _mm256_set1_epi8((char)(psize - 1));
+  __m256i lo = _mm256_setzero_si256(), hi = lo;
+  __m256i inRange = _mm256_set1_epi8(-1);
+  for (int r = 0; r < rows; r += 2) {
+    __m256i idx = _mm256_sub_epi8(
+        _mm256_loadu_si256((const __m256i *)layout[r]), one);
+    inRange = _mm256_and_si256(
+        inRange, _mm256_cmpeq_epi8(_mm256_max_epu8(idx, limit), limit));
+    lo = _mm256_or_si256(lo, _mm256_shuffle_epi8(lutLo, idx));
+    hi = _mm256_or_si256(hi, _mm256_shuffle_epi8(lutHi, idx));
+  }
+  __m128i lo128 = _mm_or_si128(_mm256_castsi256_si128(lo),
+                               _mm256_extracti128_si256(lo, 1));
+  __m128i hi128 = _mm_or_si128(_mm256_castsi256_si128(hi),
+                               _mm256_extracti128_si256(hi, 1));
+  __m128i range = _mm_and_si128(_mm256_castsi256_si128(inRange),
+                                _mm256_extracti128_si256(inRange, 1));
+  uint32_t full = (uint32_t)fullMaskWord(psize, 0);
+  __m128i ok = _mm_and_si128(
+      range, _mm_and_si128(_mm_cmpeq_epi8(lo128, _mm_set1_epi8((char)full)),
+                           _mm_cmpeq_epi8(hi128,
+                                          _mm_set1_epi8((char)(full >> 8)))));
+  uint32_t lanes = (1u << psize) - 1;
+  return ((uint32_t)_mm_movemask_epi8(ok) & lanes) == lanes;
+}
+
+// returns the best kernel this CPU supports, or NULL. The CPU is probed
+// once by the compiler runtime, so asking again per puzzle is cheap.
+static SimdKernel simdSelectKernel(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return simdKernelAvx2;
+  if (__builtin_cpu_supports("ssse3"))
+    return simdKernelSsse3;
+  return NULL;
+}
+
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+static bool simdKernelNeon(const uint8_t (*layout)[16], int rows, int psize) {
+  // tbl returns 0 for indices past the table, so 0 (wrapped to 255) and
+  // numbers above 16 contribute no bits and the range check flags them
+  static const uint8_t lutLoBytes[16] = {1, 2, 4, 8, 16, 32, 64, 128};
+  static const uint8_t lutHiBytes[16] = {0, 0, 0,  0,  0,  0,  0,   0,
+                                         1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t lutLo = vld1q_u8(lutLoBytes), lutHi = vld1q_u8(lutHiBytes);
+  const uint8x16_t one = vdupq_n_u8(1);
+  const uint8x16_t limit = vdupq_n_u8((uint8_t)(psize - 1));
+  uint8x16_t lo = vdupq_n_u8(0), hi = lo;
+  uint8x16_t inRange = vdupq_n_u8(0xFF);
+  for (int r = 0; r < rows; r++) {
+    uint8x16_t idx = vsubq_u8(vld1q_u8(layout[r]), one);
+    inRange = vandq_u8(inRange, vcleq_u8(idx, limit));
+    lo = vorrq_u8(lo, vqtbl1q_u8(lutLo, idx));
+    hi = vorrq_u8(hi, vqtbl1q_u8(lutHi, idx));
+  }
+  uint32_t full = (uint32_t)fullMaskWord(psize, 0);
+  uint8x16_t ok = vandq_u8(
+      inRange, vandq_u8(vceqq_u8(lo, vdupq_n_u8((uint8_t)full)),
+                        vceqq_u8(hi, vdupq_n_u8((uint8_t)(full >> 8)))));
+  // force the lanes past psize to pass, then require every lane to pass
+  static const uint8_t laneIds[16] = {0, 1, 2,  3,  4,  5,  6,  7,
+                                      8, 9, 10, 11, 12, 13, 14, 15};
+  uint8x16_t unused = vcgeq_u8(vld1q_u8(laneIds), vdupq_n_u8((uint8_t)psize));
+  return vminvq_u8(vorrq_u8(ok, unused)) == 0xFF;
+}
+
+static SimdKernel simdSelectKernel(void) { return simdKernelNeon; }
+
+#else
+static SimdKernel simdSelectKernel(void) { return NULL; }
+#endif
+
+// returns true if validateBoardSimd can check this grid on this CPU
+bool simdSupported(const SudokuGrid *grid) {
+  int n = (int)(sqrt(grid->psize) + 0.5);
+  return simdSelectKernel() != NULL && grid->psize <= SIMD_MAX_PSIZE &&
+         grid->cellBytes == 1 && n * n == grid->psize;
+}
+
+// takes a grid accepted by simdSupported
+// returns true if every row, column and box holds 1..psize exactly once,
+// checking the whole board on the calling thread with vector instructions
+static bool validateBoardSimd(const SudokuGrid *grid) {
+  int psize = grid->psize;
+  int n = (int)(sqrt(psize) + 0.5);
+  SimdKernel simdKernel = simdSelectKernel();
+  SimdLayouts lay;
+  simdGather(grid, n, &lay);
+  int rows = psize + psize % 2;
+  return simdKernel(lay.byRow, rows, psize) &&
+         simdKernel(lay.byCol, rows, psize) &&
+         simdKernel(lay.byBox, rows, psize);
+}
+
+// Whole-board kernel for one common board size. Size P, box size N and
+// the mask type are compile-time constants, so the loops unroll and each
+// region mask is the narrowest integer that holds P bits. One pass over
+// the cells sets the complete flag and ORs every cell into the masks of
+// its row, column and box; the board is valid when every mask is full.
+// Cells outside 1..P, including 0, make the board invalid.
+#define FIXED_KERNEL(P, N, MaskType)                                         \
+  static void fixedCheck##P(const uint8_t *cells, bool *complete,            \
+                            bool *valid) {                                   \
+    MaskType rows[P] = {0}, cols[P] = {0}, boxes[P] = {0};                   \
+    unsigned outOfRange = 0, empty = 0;                                      \
+    for (int row = 0; row < P; row++) {                                      \
+      for (int col = 0; col < P; col++) {                                    \
+        unsigned num = cells[row * P + col];                                 \
+        unsigned bit = num - 1;                                              \
+        empty |= num == 0;                                                   \
+        outOfRange |= bit >= P;                                              \
+        MaskType mask = (MaskType)(1ULL << (bit & 63));                      \
+        rows[row] |= mask;                                                   \
+        cols[col] |= mask;                                                   \
+        boxes[(row / N) * N + col / N] |= mask;                              \
+      }                                                                      \
+    }                                                                        \
+    MaskType full = (MaskType)((1ULL << P) - 1), all = full;                 \
+    for (int i = 0; i < P; i++)                                              \
+      all &= rows[i] & cols[i] & boxes[i];                                   \
+    *complete = !empty;                                                      \
+    *valid = !empty && !outOfRange && all == full;                           \
+  }
+
+FIXED_KERNEL(4, 2, uint8_t)
+FIXED_KERNEL(9, 3, uint16_t)
+FIXED_KERNEL(16, 4, uint16_t)
+FIXED_KERNEL(25, 5, uint32_t)
+
+typedef void (*FixedKernel)(const uint8_t *cells, bool *complete,
+                            bool *valid);
+
+// takes a puzzle size
+// returns the fixed-size kernel for it, or NULL to use the generic code
+static FixedKernel fixedKernel(int psize) {
+  switch (psize) {
+  case 4:
+    return fixedCheck4;
+  case 9:
+    return fixedCheck9;
+  case 16:
+    return fixedCheck16;
+  case 25:
+    return fixedCheck25;
+  default:
+    return NULL;
+  }
+}
+
+// returns true if psize has a kernel of its own
+bool fixedKernelSupported(int psize) {
+  return fixedKernel(psize) != NULL;
+}
+
+// Boards with more cells than this are not given a region table.
+#define REGION_TABLE_MAX_CELLS (1 << 22)
+
+// Box of every cell of one board size, row-major, so a single sweep over
+// the cells can update a cell's row, column and box masks at once (the row
+// and column are the loop counters). Built on first use of a size.
+struct RegionTable {
+  int psize;
+  uint16_t *boxOf;
+  struct RegionTable *next;
+};
+
+// Tables built so far, one per board size. Lookups walk the list without
+// locking; the lock only serializes adding a table, which is published
+// with a release store once it is complete.
+struct RegionTableCache {
+  pthread_mutex_t lock;
+  _Atomic(RegionTable *) tables; // newest first
+};
+
+RegionTableCache *createRegionTableCache(void) {
+  RegionTableCache *cache = malloc(sizeof(RegionTableCache));
+  pthread_mutex_init(&cache->lock, NULL);
+  atomic_init(&cache->tables, NULL);
+  return cache;
+}
+
+void deleteRegionTableCache(RegionTableCache *cache) {
+  if (cache == NULL)
+    return;
+  RegionTable *table = atomic_load(&cache->tables);
+  while (table != NULL) {
+    RegionTable *next = table->next;
+    free(table->boxOf);
+    free(table);
+    table = next;
+  }
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+static RegionTable *findRegionTable(RegionTable *table, int psize) {
+  while (table != NULL && table->psize != psize)
+    table = table->next;
+  return table;
+}
+
+// takes a cache and a puzzle size
+// returns the table for psize, building it if this is the first puzzle of
+// that size, or NULL if the board is not square or too large for a table
+const RegionTable *regionTable(RegionTableCache *cache, int psize) {
+  int n = (int)(sqrt(psize) + 0.5);
+  if (n * n != psize || (size_t)psize * psize > REGION_TABLE_MAX_CELLS)
+    return NULL;
+  RegionTable *table = findRegionTable(
+      atomic_load_explicit(&cache->tables, memory_order_acquire), psize);
+  if (table != NULL)
+    return table;
+  pthread_mutex_lock(&cache->lock);
+  RegionTable *head = atomic_load_explicit(&cache->tables, memory_order_relaxed);
+  table = findRegionTable(head, psize);
+  if (table == NULL) {
+    table = malloc(sizeof(RegionTable));
+    table->psize = psize;
+    table->boxOf = malloc((size_t)psize * psize * sizeof(uint16_t));
+    for (int row = 0; row < psize; row++)
+      for (int col = 0; col < psize; col++)
+        table->boxOf[row * psize + col] = (row / n) * n + col / n;
+    table->next = head;
+    atomic_store_explicit(&cache->tables, table, memory_order_release);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return table;
+}
+
+// takes the table for the grid's size and a grid
+// sets complete and valid from one row-major sweep that ORs every cell into
+// the masks of its row, column and box; valid if every mask is full and no
+// cell is out of range. The sweep ends at the first row with an empty cell.
+static void validateBoardTable(const SudokuContext *ctx,
+                               const RegionTable *table,
+                               const SudokuGrid *grid, bool *complete,
+                               bool *valid) {
+  int psize = grid->psize;
+  unsigned usize = (unsigned)psize;
+  int words = BITSET_WORDS(psize);
+  Arena local = {NULL};
+  Arena *arena = scratchArena(ctx, &local);
+  ArenaMark mark = arenaMark(arena);
+  uint64_t *masks = arenaCalloc(arena, (size_t)3 * psize * words,
+                                sizeof(uint64_t));
+  uint64_t *rowMask = masks;
+  uint64_t *colMask = masks + (size_t)psize * words;
+  uint64_t *boxMask = masks + (size_t)2 * psize * words;
+  const uint16_t *boxOf = table->boxOf;
+  bool empty = false, outOfRange = false;
+  for (int row = 0; row < psize; row++) {
+    for (int col = 0; col < psize; col++) {
+      unsigned num = (unsigned)gridGet(grid, row + 1, col + 1);
+      unsigned bit = num - 1;
+      empty |= num == 0;
+      outOfRange |= bit >= usize;
+      bit = bit < usize ? bit : 0;
+      int w = bit >> 6;
+      uint64_t m = 1ULL << (bit & 63);
+      rowMask[row * words + w] |= m;
+      colMask[col * words + w] |= m;
+      boxMask[boxOf[row * psize + col] * words + w] |= m;
+    }
+    if (empty)
+      break; // incomplete: validity is not defined
+  }
+  bool full = !empty && !outOfRange;
+  for (int r = 0; r < 3 * psize && full; r++)
+    for (int w = 0; w < words && full; w++)
+      full = masks[(size_t)r * words + w] == fullMaskWord(psize, w);
+  arenaRelease(arena, mark);
+  arenaDestroy(&local);
+  *complete = !empty;
+  *valid = full;
+}
+
+// A run of regions checked by one task under THREADS_CHUNKED, padded to a
+// cache line like ThreadData.
+typedef struct {
+  _Alignas(CACHE_LINE) ThreadData *regions;
+  int count;
+  bool valid; // Result: true if every region in the run is valid.
+} RegionChunk;
+
+// Thread function to validate a run of regions one after another.
+static void *validateChunk(void *param) {
+  RegionChunk *chunk = (RegionChunk *)param;
+  chunk->valid = true;
+  for (int i = 0; i < chunk->count && chunk->valid; i++) {
+    validateRegion(&chunk->regions[i]);
+    if (chunk->regions[i].valid == 0)
+      chunk->valid = false;
+  }
+  return NULL;
+}
+
+// Boards at least this large split the top of the search tree into pool
+// tasks, unless the thread policy is inline.
+#define SOLVER_PARALLEL_PSIZE 25
+
+// State shared by every task of one search: the unit tables, which never
+// change, and the solutions found so far.
+typedef struct {
+  ThreadPool *pool; // NULL for a search on the calling thread
+  TaskGroup group;
+  SudokuStats *stats;
+  int *units;       // cell indices of each row, column and box, psize each
+  long limit;       // number of solutions after which the search stops
+  atomic_long found; // solutions found by all tasks
+  atomic_bool stop;  // set once found reaches limit
+  int *solution;     // copy of the first solution found
+} SolverShared;
+
+// State for the backtracking solver. Each row, column and box keeps a mask
+// of the numbers it already holds (bit num-1), so the candidates of a cell
+// are the numbers missing from all three of its regions. A parallel search
+// gives every task its own Solver, copied from its parent at the split.
+typedef struct {
+  SolverShared *shared;
+  int psize;
+  int n;
+  int ncells;        // psize * psize
+  uint64_t full;     // mask with bits 0..psize-1 set
+  int *cells;        // row-major copy of the grid, 0 for empty
+  uint64_t *rowUsed; // numbers placed in each row
+  uint64_t *colUsed; // numbers placed in each column
+  uint64_t *boxUsed; // numbers placed in each box
+  const int *units;  // shared->units
+  int *trail;        // cells assigned so far, undone on backtrack
+  int trailSize;
+  int split;           // levels left at which branches become tasks
+  uint64_t nodes;      // search nodes visited
+  uint64_t backtracks; // branches undone
+} Solver;
+
+// allocates the state of s from arena, or from the heap if arena is NULL
+static void solverInit(Solver *s, SolverShared *shared, int psize, int n,
+                       Arena *arena) {
+  s->shared = shared;
+  s->psize = psize;
+  s->n = n;
+  s->ncells = psize * psize;
+  s->full = fullMaskWord(psize, 0);
+  if (arena == NULL) {
+    s->cells = malloc(s->ncells * sizeof(int));
+    s->trail = malloc(s->ncells * sizeof(int));
+    s->rowUsed = calloc(3 * psize, sizeof(uint64_t));
+  } else {
+    s->cells = arenaAlloc(arena, s->ncells * sizeof(int));
+    s->trail = arenaAlloc(arena, s->ncells * sizeof(int));
+    s->rowUsed = arenaCalloc(arena, 3 * psize, sizeof(uint64_t));
+  }
+  s->colUsed = s->rowUsed + psize;
+  s->boxUsed = s->colUsed + psize;
+  s->units = shared->units;
+  s->trailSize = 0;
+  s->split = 0;
+  s->nodes = 0;
+  s->backtracks = 0;
+}
+
+// frees the state of a Solver initialized from the heap
+static void solverFree(Solver *s) {
+  free(s->cells);
+  free(s->trail);
+  free(s->rowUsed);
+}
+
+static inline int solverBox(const Solver *s, int cell) {
+  int row = cell / s->psize, col = cell % s->psize;
+  return (row / s->n) * s->n + col / s->n;
+}
+
+static inline uint64_t solverCandidates(const Solver *s, int cell) {
+  int row = cell / s->psize, col = cell % s->psize;
+  return s->full &
+         ~(s->rowUsed[row] | s->colUsed[col] | s->boxUsed[solverBox(s, cell)]);
+}
+
+static inline void solverAssign(Solver *s, int cell, int num) {
+  uint64_t bit = 1ULL << (num - 1);
+  s->cells[cell] = num;
+  s->rowUsed[cell / s->psize] |= bit;
+  s->colUsed[cell % s->psize] |= bit;
+  s->boxUsed[solverBox(s, cell)] |= bit;
+  s->trail[s->trailSize++] = cell;
+}
+
+// clears every assignment made after the trail had mark entries
+static void solverUndo(Solver *s, int mark) {
+  while (s->trailSize > mark) {
+    int cell = s->trail[--s->trailSize];
+    uint64_t bit = ~(1ULL << (s->cells[cell] - 1));
+    s->cells[cell] = 0;
+    s->rowUsed[cell / s->psize] &= bit;
+    s->colUsed[cell % s->psize] &= bit;
+    s->boxUsed[solverBox(s, cell)] &= bit;
+  }
+}
+
+// mask of numbers already placed in unit u
+static inline uint64_t solverUnitUsed(const Solver *s, int u) {
+  if (u < s->psize)
+    return s->rowUsed[u];
+  if (u < 2 * s->psize)
+    return s->colUsed[u - s->psize];
+  return s->boxUsed[u - 2 * s->psize];
+}
+
+// assigns naked singles (cells with one candidate) and hidden singles
+// (numbers with one possible cell in a region) until neither applies.
+// returns false if some cell or region is left without options
+static bool solverPropagate(Solver *s) {
+  int psize = s->psize;
+  bool progress;
+  do {
+    progress = false;
+    for (int cell = 0; cell < s->ncells; cell++) {
+      if (s->cells[cell] != 0)
+        continue;
+      uint64_t cand = solverCandidates(s, cell);
+      if (cand == 0)
+        return false;
+      if ((cand & (cand - 1)) == 0) {
+        solverAssign(s, cell, __builtin_ctzll(cand) + 1);
+        progress = true;
+      }
+    }
+    for (int u = 0; u < 3 * psize; u++) {
+      const int *unit = &s->units[u * psize];
+      uint64_t once = 0, twice = 0;
+      for (int k = 0; k < psize; k++) {
+        if (s->cells[unit[k]] == 0) {
+          uint64_t cand = solverCandidates(s, unit[k]);
+          twice |= once & cand;
+          once |= cand;
+        }
+      }
+      uint64_t used = solverUnitUsed(s, u);
+      if ((once | used) != s->full)
+        return false;
+      for (uint64_t hidden = once & ~twice & ~used; hidden != 0;
+           hidden &= hidden - 1) {
+        int bit = __builtin_ctzll(hidden);
+        int k = 0;
+        while (k < psize && (s->cells[unit[k]] != 0 ||
+                             !(solverCandidates(s, unit[k]) >> bit & 1)))
+          k++;
+        if (k == psize)
+          return false;
+        solverAssign(s, unit[k], bit + 1);
+        progress = true;
+      }
+    }
+  } while (progress);
+  return true;
+}
+
+static bool solverSearch(Solver *s);
+
+// Thread function to search the subtree a Solver copy was made for.
+static void *solverTask(void *param) {
+  Solver *s = (Solver *)param;
+  solverSearch(s);
+  STAT_ADD(s->shared->stats, solverNodes, s->nodes);
+  STAT_ADD(s->shared->stats, solverBacktracks, s->backtracks);
+  solverFree(s);
+  free(s);
+  return NULL;
+}
+
+// submits one task per candidate of cell, each on its own copy of s.
+// Copies live on the heap: a task may outlast the task that spawned it,
+// so they cannot come from the spawning thread's scratch arena.
+static void solverSpawn(Solver *s, int cell) {
+  SolverShared *shared = s->shared;
+  for (uint64_t cand = solverCandidates(s, cell); cand != 0;
+       cand &= cand - 1) {
+    Solver *child = malloc(sizeof(Solver));
+    solverInit(child, shared, s->psize, s->n, NULL);
+    memcpy(child->cells, s->cells, s->ncells * sizeof(int));
+    memcpy(child->rowUsed, s->rowUsed, 3 * s->psize * sizeof(uint64_t));
+    child->split = s->split - 1;
+    solverAssign(child, cell, __builtin_ctzll(cand) + 1);
+    STAT_ADD(shared->stats, tasks, 1);
+    STAT_ADD(shared->stats, allocations, 4);
+    threadPoolSubmit(shared->pool, &shared->group, solverTask, child);
+  }
+}
+
+// propagates, then branches on the empty cell with the fewest candidates.
+// Each solution is counted in s->shared and the first one copied there;
+// while s->split is positive, branches are handed to the pool instead.
+// returns true once the search should end because shared->limit solutions
+// were found, here or by another task. s is restored either way.
+static bool solverSearch(Solver *s) {
+  SolverShared *shared = s->shared;
+  if (atomic_load_explicit(&shared->stop, memory_order_relaxed))
+    return true;
+  int mark = s->trailSize;
+  s->nodes++;
+  if (!solverPropagate(s)) {
+    solverUndo(s, mark);
+    return false;
+  }
+  int best = -1, bestCount = s->psize + 1;
+  for (int cell = 0; cell < s->ncells && bestCount > 2; cell++) {
+    if (s->cells[cell] == 0) {
+      int count = __builtin_popcountll(solverCandidates(s, cell));
+      if (count < bestCount)
+        best = cell, bestCount = count;
+    }
+  }
+  bool done = false;
+  if (best < 0) {
+    long found = atomic_fetch_add(&shared->found, 1) + 1;
+    if (found == 1)
+      memcpy(shared->solution, s->cells, s->ncells * sizeof(int));
+    done = found >= shared->limit;
+    if (done)
+      atomic_store(&shared->stop, true);
+  } else if (s->split > 0) {
+    solverSpawn(s, best);
+  } else {
+    for (uint64_t cand = solverCandidates(s, best); cand != 0 && !done;
+         cand &= cand - 1) {
+      int branch = s->trailSize;
+      solverAssign(s, best, __builtin_ctzll(cand) + 1);
+      done = solverSearch(s);
+      solverUndo(s, branch);
+      if (!done)
+        s->backtracks++;
+    }
+  }
+  solverUndo(s, mark);
+  return done;
+}
+
+// Dancing Links (Algorithm X) engine. A board of size N is the exact-cover
+// problem with N^3 rows, one per (cell, number), and 4 N^2 columns: each
+// cell must hold one number, and each row, column and box must hold each
+// number once. Nodes are array indices: 0 is the root, 1..columns the
+// column headers, then four nodes per matrix row in row order.
+typedef struct {
+  int left, right, up, down;
+  int column;
+} DlxNode;
+
+// Links and column sizes of a matrix, pristine or being searched.
+typedef struct DlxWork {
+  DlxNode *nodes;
+  int *sizes; // rows left in each column, indexed by header
+  struct DlxWork *next; // next idle copy
+} DlxWork;
+
+// The linked matrix of one board size with every row present, built once.
+// A search checks out a working copy and, because every cover is undone
+// in reverse order when it ends, hands it back pristine; copies are only
+// made when more threads search at once than there are idle copies.
+typedef struct DlxMatrix {
+  int psize;
+  int columns;
+  int nodeCount;
+  DlxWork pristine;
+  pthread_mutex_t lock; // guards idle
+  DlxWork *idle;
+  struct DlxMatrix *next;
+} DlxMatrix;
+
+// Matrices built so far, one per size, shared like RegionTableCache.
+struct DlxCache {
+  pthread_mutex_t lock;
+  _Atomic(DlxMatrix *) matrices; // newest first
+};
+
+DlxCache *createDlxCache(void) {
+  DlxCache *cache = malloc(sizeof(DlxCache));
+  pthread_mutex_init(&cache->lock, NULL);
+  atomic_init(&cache->matrices, NULL);
+  return cache;
+}
+
+void deleteDlxCache(DlxCache *cache) {
+  if (cache == NULL)
+    return;
+  DlxMatrix *matrix = atomic_load(&cache->matrices);
+  while (matrix != NULL) {
+    DlxMatrix *next = matrix->next;
+    while (matrix->idle != NULL) {
+      DlxWork *work = matrix->idle;
+      matrix->idle = work->next;
+      free(work->nodes);
+      free(work->sizes);
+      free(work);
+    }
+    free(matrix->pristine.nodes);
+    free(matrix->pristine.sizes);
+    pthread_mutex_destroy(&matrix->lock);
+    free(matrix);
+    matrix = next;
+  }
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
+
+static DlxMatrix *buildDlxMatrix(int psize, int n) {
+  DlxMatrix *m = malloc(sizeof(DlxMatrix));
+  int cells = psize * psize;
+  m->psize = psize;
+  m->columns = 4 * cells;
+  m->nodeCount = 1 + m->columns + 4 * cells * psize;
+  DlxNode *nodes = m->pristine.nodes = malloc(m->nodeCount * sizeof(DlxNode));
+  int *sizes = m->pristine.sizes = calloc(1 + m->columns, sizeof(int));
+  pthread_mutex_init(&m->lock, NULL);
+  m->idle = NULL;
+  for (int c = 0; c <= m->columns; c++)
+    nodes[c] = (DlxNode){c - 1, c + 1, c, c, c};
+  nodes[0].left = m->columns;
+  nodes[m->columns].right = 0;
+  int next = 1 + m->columns;
+  for (int cell = 0; cell < cells; cell++) {
+    int row = cell / psize, col = cell % psize;
+    int box = (row / n) * n + col / n;
+    for (int v = 0; v < psize; v++) {
+      int hit[4] = {1 + cell, 1 + cells + row * psize + v,
+                    1 + 2 * cells + col * psize + v,
+                    1 + 3 * cells + box * psize + v};
+      for (int k = 0; k < 4; k++) {
+        DlxNode *node = &nodes[next + k];
+        DlxNode *header = &nodes[hit[k]];
+        node->left = next + (k + 3) % 4;
+        node->right = next + (k + 1) % 4;
+        node->column = hit[k];
+        node->up = header->up;
+        node->down = hit[k];
+        nodes[header->up].down = next + k;
+        header->up = next + k;
+        sizes[hit[k]]++;
+      }
+      next += 4;
+    }
+  }
+  return m;
+}
+
+// takes a cache and a puzzle size the solver accepts
+// returns the pristine matrix for psize, building it on first use
+static DlxMatrix *dlxMatrix(DlxCache *cache, int psize, int n) {
+  DlxMatrix *m = atomic_load_explicit(&cache->matrices, memory_order_acquire);
+  while (m != NULL && m->psize != psize)
+    m = m->next;
+  if (m != NULL)
+    return m;
+  pthread_mutex_lock(&cache->lock);
+  DlxMatrix *head = atomic_load_explicit(&cache->matrices, memory_order_relaxed);
+  for (m = head; m != NULL && m->psize != psize; m = m->next)
+    ;
+  if (m == NULL) {
+    m = buildDlxMatrix(psize, n);
+    m->next = head;
+    atomic_store_explicit(&cache->matrices, m, memory_order_release);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return m;
+}
+
+// returns an idle pristine copy of m, making one if none is free
+static DlxWork *dlxCheckout(DlxMatrix *m) {
+  pthread_mutex_lock(&m->lock);
+  DlxWork *work = m->idle;
+  if (work != NULL)
+    m->idle = work->next;
+  pthread_mutex_unlock(&m->lock);
+  if (work == NULL) {
+    work = malloc(sizeof(DlxWork));
+    work->nodes = malloc(m->nodeCount * sizeof(DlxNode));
+    memcpy(work->nodes, m->pristine.nodes, m->nodeCount * sizeof(DlxNode));
+    work->sizes = malloc((1 + m->columns) * sizeof(int));
+    memcpy(work->sizes, m->pristine.sizes, (1 + m->columns) * sizeof(int));
+  }
+  return work;
+}
+
+// takes a copy restored to its pristine state
+static void dlxCheckin(DlxMatrix *m, DlxWork *work) {
+  pthread_mutex_lock(&m->lock);
+  work->next = m->idle;
+  m->idle = work;
+  pthread_mutex_unlock(&m->lock);
+}
+
+// Search state over a checked-out copy of a matrix.
+typedef struct {
+  DlxNode *nodes;
+  int *sizes;
+  int cellColumns; // psize * psize; the first columns are the cells
+  int psize;
+  int firstRowNode; // index of the first node of matrix row 0
+  int *chosen;      // first node of each row picked so far
+  int depth;
+  long limit;
+  long found;
+  int *solution;    // row-major cells, givens already placed
+  uint64_t nodesVisited;
+  uint64_t backtracks;
+} Dlx;
+
+static void dlxCover(Dlx *d, int c) {
+  DlxNode *x = d->nodes;
+  x[x[c].right].left = x[c].left;
+  x[x[c].left].right = x[c].right;
+  for (int i = x[c].down; i != c; i = x[i].down) {
+    for (int j = x[i].right; j != i; j = x[j].right) {
+      x[x[j].down].up = x[j].up;
+      x[x[j].up].down = x[j].down;
+      d->sizes[x[j].column]--;
+    }
+  }
+}
+
+static void dlxUncover(Dlx *d, int c) {
+  DlxNode *x = d->nodes;
+  for (int i = x[c].up; i != c; i = x[i].up) {
+    for (int j = x[i].left; j != i; j = x[j].left) {
+      d->sizes[x[j].column]++;
+      x[x[j].down].up = j;
+      x[x[j].up].down = j;
+    }
+  }
+  x[x[c].right].left = c;
+  x[x[c].left].right = c;
+}
+
+// records the picked rows in d->solution
+static void dlxStoreSolution(Dlx *d) {
+  for (int i = 0; i < d->depth; i++) {
+    int row = (d->chosen[i] - d->firstRowNode) / 4;
+    d->solution[row / d->psize] = row % d->psize + 1;
+  }
+}
+
+// Algorithm X, branching on the column with the fewest rows. Every cover
+// is undone before returning, so the matrix is left as it was found.
+// returns true once d->limit solutions were found
+static bool dlxSearch(Dlx *d) {
+  DlxNode *x = d->nodes;
+  if (x[0].right == 0) {
+    if (++d->found == 1)
+      dlxStoreSolution(d);
+    return d->found >= d->limit;
+  }
+  int best = x[0].right;
+  for (int c = x[best].right; c != 0 && d->sizes[best] > 1; c = x[c].right) {
+    if (d->sizes[c] < d->sizes[best])
+      best = c;
+  }
+  if (d->sizes[best] == 0)
+    return false;
+  dlxCover(d, best);
+  bool done = false;
+  for (int r = x[best].down; r != best && !done; r = x[r].down) {
+    d->chosen[d->depth++] = r;
+    d->nodesVisited++;
+    for (int j = x[r].right; j != r; j = x[j].right)
+      dlxCover(d, x[j].column);
+    done = dlxSearch(d);
+    for (int j = x[r].left; j != r; j = x[j].left)
+      dlxUncover(d, x[j].column);
+    d->depth--;
+    if (!done)
+      d->backtracks++;
+  }
+  dlxUncover(d, best);
+  return done;
+}
+
+// takes a context with a DLX cache, a board the solver accepts, a limit
+// and a buffer for the first solution
+// returns the number of solutions up to limit, as solverRun does
+static long dlxRun(const SudokuContext *ctx, const SudokuGrid *grid,
+                   long limit, int *solution) {
+  int psize = grid->psize;
+  int n = (int)(sqrt(psize) + 0.5);
+  DlxMatrix *m = dlxMatrix(ctx->matrices, psize, n);
+  DlxWork *work = dlxCheckout(m);
+  Arena local = {NULL};
+  Arena *arena = scratchArena(ctx, &local);
+  ArenaMark mark = arenaMark(arena);
+  Dlx d;
+  d.nodes = work->nodes;
+  d.sizes = work->sizes;
+  d.cellColumns = psize * psize;
+  d.psize = psize;
+  d.firstRowNode = 1 + m->columns;
+  d.chosen = arenaAlloc(arena, psize * psize * sizeof(int));
+  d.depth = 0;
+  d.limit = limit;
+  d.found = 0;
+  d.solution = solution;
+  d.nodesVisited = 0;
+  d.backtracks = 0;
+  // select the row of each given; a given whose row was already removed
+  // by an earlier one conflicts with it
+  bool *covered = arenaCalloc(arena, 1 + m->columns, sizeof(bool));
+  int *givenColumns = arenaAlloc(arena, m->columns * sizeof(int));
+  int givenCount = 0;
+  bool consistent = true;
+  for (int cell = 0; cell < psize * psize && consistent; cell++) {
+    int num = gridGet(grid, cell / psize + 1, cell % psize + 1);
+    solution[cell] = num;
+    if (num == 0)
+      continue;
+    if (num < 0 || num > psize) {
+      consistent = false;
+      break;
+    }
+    int r = d.firstRowNode + 4 * (cell * psize + num - 1);
+    for (int k = 0; k < 4 && consistent; k++)
+      consistent = !covered[d.nodes[r + k].column];
+    for (int k = 0; k < 4 && consistent; k++) {
+      int c = d.nodes[r + k].column;
+      covered[c] = true;
+      givenColumns[givenCount++] = c;
+      dlxCover(&d, c);
+    }
+  }
+  if (consistent)
+    dlxSearch(&d);
+  while (givenCount > 0)
+    dlxUncover(&d, givenColumns[--givenCount]);
+  dlxCheckin(m, work);
+  arenaRelease(arena, mark);
+  arenaDestroy(&local);
+  SudokuStats *stats = ctx->stats;
+  STAT_ADD(stats, solverCalls, 1);
+  STAT_ADD(stats, solverNodes, d.nodesVisited);
+  STAT_ADD(stats, solverBacktracks, d.backtracks);
+  return d.found < limit ? d.found : limit;
+}
+
+// takes a context (or NULL), a grid, a solution limit and a psize*psize
+// buffer for the first solution, which is copied there if one is found.
+// Counts solutions up to limit with constraint propagation and
+// backtracking. Large boards searched with a pool split the first levels
+// of the tree into tasks on their own board copies; the first task to
+// reach the limit stops the rest, so which of several solutions comes
+// back first depends on timing.
+// returns the number of solutions found, at most limit, or -1 if the
+// board is too large for the solver
+static long solverRun(const SudokuContext *ctx, const SudokuGrid *grid,
+                      long limit, int *solution) {
+  int psize = grid->psize;
+  int n = (int)(sqrt(psize) + 0.5);
+  if (psize > SOLVER_MAX_PSIZE || n * n != psize)
+    return -1;
+  if (ctx != NULL && ctx->engine == ENGINE_DLX && ctx->matrices != NULL)
+    return dlxRun(ctx, grid, limit, solution);
+  Arena local = {NULL};
+  Arena *arena = scratchArena(ctx, &local);
+  ArenaMark mark = arenaMark(arena);
+  SolverShared shared;
+  shared.pool = NULL;
+  if (ctx != NULL && ctx->pool != NULL && ctx->pool->nworkers > 1 &&
+      ctx->threads != THREADS_INLINE && psize >= SOLVER_PARALLEL_PSIZE)
+    shared.pool = ctx->pool;
+  atomic_init(&shared.group.pending, 0);
+  shared.stats = ctx == NULL ? NULL : ctx->stats;
+  shared.limit = limit;
+  atomic_init(&shared.found, 0);
+  atomic_init(&shared.stop, false);
+  shared.solution = solution;
+  shared.units = arenaAlloc(arena, 3 * psize * psize * sizeof(int));
+  for (int i = 0; i < psize; i++) {
+    for (int k = 0; k < psize; k++) {
+      shared.units[i * psize + k] = i * psize + k;             // row i
+      shared.units[(psize + i) * psize + k] = k * psize + i;   // column i
+      shared.units[(2 * psize + i) * psize + k] =              // box i
+          ((i / n) * n + k / n) * psize + (i % n) * n + k % n;
+    }
+  }
+  Solver s;
+  solverInit(&s, &shared, psize, n, arena);
+  if (shared.pool != NULL) {
+    // enough levels that a mostly two-way tree gives each worker ~8 tasks
+    while ((1 << s.split) < 8 * shared.pool->nworkers && s.split < 16)
+      s.split++;
+  }
+  // place the givens, rejecting any that are out of range or conflict
+  bool consistent = true;
+  for (int cell = 0; cell < s.ncells && consistent; cell++) {
+    int num = gridGet(grid, cell / psize + 1, cell % psize + 1);
+    s.cells[cell] = 0;
+    if (num == 0)
+      continue;
+    if (num < 0 || num > psize || !(solverCandidates(&s, cell) >> (num - 1) & 1))
+      consistent = false;
+    else
+      solverAssign(&s, cell, num);
+  }
+  if (consistent) {
+    solverSearch(&s);
+    threadPoolWait(shared.pool, &shared.group);
+  }
+  long found = atomic_load(&shared.found);
+  arenaRelease(arena, mark);
+  arenaDestroy(&local);
+  STAT_ADD(shared.stats, solverCalls, 1);
+  STAT_ADD(shared.stats, solverNodes, s.nodes);
+  STAT_ADD(shared.stats, solverBacktracks, s.backtracks);
+  return found < limit ? found : limit;
+}
+
+// takes a context (or NULL) and a grid
+// fills every 0 using constraint propagation and backtracking search.
+// returns true if the grid was completed; otherwise grid is left unchanged
+// (the givens conflict, there is no solution, or the board is too large)
+bool solvePuzzle(const SudokuContext *ctx, SudokuGrid *grid) {
+  int psize = grid->psize;
+  Arena local = {NULL};
+  Arena *arena = scratchArena(ctx, &local);
+  ArenaMark mark = arenaMark(arena);
+  int *solution = arenaAlloc(arena, (size_t)psize * psize * sizeof(int));
+  bool solved = solverRun(ctx, grid, 1, solution) > 0;
+  if (solved) {
+    for (int cell = 0; cell < psize * psize; cell++)
+      gridSet(grid, cell / psize + 1, cell % psize + 1, solution[cell]);
+  }
+  arenaRelease(arena, mark);
+  arenaDestroy(&local);
+  return solved;
+}
+
+static void verifyPuzzleUntimed(const SudokuContext *ctx,
+                                const SudokuGrid *grid, bool *complete,
+                                bool *valid);
+
+// takes a context (or NULL), a grid and a limit of at least 1
+// returns how many ways the 0s of grid can be filled, counting no further
+// than limit. With limit 2 this answers whether the solution is unique at
+// the cost of about one solve: the search goes on from where the first
+// solution was found and stops at the second. A full board counts as 1 if
+// valid and 0 if not at any size; otherwise boards too large for the
+// solver return -1.
+long countSolutions(const SudokuContext *ctx, const SudokuGrid *grid,
+                    long limit) {
+  Arena local = {NULL};
+  Arena *arena = scratchArena(ctx, &local);
+  ArenaMark mark = arenaMark(arena);
+  int *solution =
+      arenaAlloc(arena, (size_t)grid->psize * grid->psize * sizeof(int));
+  long count = solverRun(ctx, grid, limit, solution);
+  arenaRelease(arena, mark);
+  arenaDestroy(&local);
+  if (count < 0) {
+    bool complete, valid;
+    verifyPuzzleUntimed(ctx, grid, &complete, &valid);
+    if (complete)
+      count = valid ? 1 : 0;
+  }
+  return count;
+}
+
+// takes region u (rows 0..psize-1, then columns, then boxes) and k in
+// 0..psize-1, and sets the 1-indexed row and column of its k-th cell
+static inline void regionCell(int psize, int n, int u, int k, int *row,
+                              int *col) {
+  if (u < psize) {
+    *row = u + 1, *col = k + 1;
+  } else if (u < 2 * psize) {
+    *row = k + 1, *col = u - psize + 1;
+  } else {
+    int box = u - 2 * psize;
+    *row = (box / n) * n + k / n + 1;
+    *col = (box % n) * n + k % n + 1;
+  }
+}
+
+// A cell the fill pass found forced: the last empty cell of a region and
+// the number missing from it. num is 0 when the region holds psize - 1
+// distinct numbers already, meaning it has a duplicate; -1 means the
+// region had no move to offer.
+typedef struct {
+  int row;
+  int col;
+  int num;
+} FillMove;
+
+// State of a parallel fill shared by the tasks of a round: each region's
+// bitset of numbers and count of empty cells, and the regions to examine.
+// Examining region i writes only moves[i] (and in the first round the
+// region's own bitset and count), so tasks need no locks.
+typedef struct {
+  SudokuGrid *grid;
+  int psize;
+  int n;
+  int words;
+  uint64_t *present;
+  int *missing;
+  const int *regions; // regions to examine, or NULL for all of them
+  FillMove *moves;    // one per examined region, in examination order
+} FillRound;
+
+// A run of examinations done by one task, padded to a cache line.
+typedef struct {
+  _Alignas(CACHE_LINE) const FillRound *round;
+  int first;
+  int last;
+} FillChunk;
+
+// takes a round and the index of a region in it
+// sets moves[i] for the region. In the first round the region's cells are
+// scanned to build its bitset and count; later rounds examine regions
+// whose count has just dropped to one, looking only for the empty cell.
+static void fillExamine(const FillRound *round, int i) {
+  int psize = round->psize, n = round->n, words = round->words;
+  int u = round->regions == NULL ? i : round->regions[i];
+  uint64_t *present = &round->present[(size_t)u * words];
+  FillMove *move = &round->moves[i];
+  int row = 0, col = 0, emptyRow = 0, emptyCol = 0, empty = 0;
+  for (int k = 0; k < psize; k++) {
+    regionCell(psize, n, u, k, &row, &col);
+    int num = gridGet(round->grid, row, col);
+    if (num == 0) {
+      empty++;
+      emptyRow = row, emptyCol = col;
+      if (round->regions != NULL)
+        break;
+    } else if (round->regions == NULL && num <= psize) {
+      present[(num - 1) / 64] |= 1ULL << ((num - 1) % 64);
+    }
+  }
+  if (round->regions == NULL)
+    round->missing[u] = empty;
+  move->num = -1;
+  if (round->missing[u] != 1)
+    return;
+  move->row = emptyRow;
+  move->col = emptyCol;
+  move->num = 0;
+  for (int w = 0; w < words && move->num == 0; w++) {
+    uint64_t absent = ~present[w] & fullMaskWord(psize, w);
+    if (absent != 0)
+      move->num = 64 * w + __builtin_ctzll(absent) + 1;
+  }
+}
+
+// Thread function to examine a run of regions of a fill round.
+static void *fillChunk(void *param) {
+  FillChunk *chunk = (FillChunk *)param;
+  for (int i = chunk->first; i < chunk->last; i++)
+    fillExamine(chunk->round, i);
+  return NULL;
+}
+
+// takes a context with a pool, a round, the number of regions to examine
+// and the arena the round lives in
+// fills in round->moves, in parallel when the round is big enough to pay
+// for the tasks
+static void fillExamineAll(const SudokuContext *ctx, const FillRound *round,
+                           int count, Arena *arena) {
+  int workers = ctx->pool->nworkers;
+  if ((long)count * round->psize < INLINE_MAX_CELLS || count < 2 * workers) {
+    for (int i = 0; i < count; i++)
+      fillExamine(round, i);
+    return;
+  }
+  // a few chunks per worker, since columns cost more than rows to scan
+  int chunks = 4 * workers < count ? 4 * workers : count;
+  ArenaMark mark = arenaMark(arena);
+  FillChunk *chunkArray =
+      arenaAllocAligned(arena, chunks * sizeof(FillChunk), CACHE_LINE);
+  TaskGroup group = {0};
+  STAT_ADD(ctx->stats, tasks, chunks);
+  for (int c = 0, first = 0; c < chunks; c++) {
+    int last = (int)((long)count * (c + 1) / chunks);
+    chunkArray[c].round = round;
+    chunkArray[c].first = first;
+    chunkArray[c].last = last;
+    threadPoolSubmit(ctx->pool, &group, fillChunk, &chunkArray[c]);
+    first = last;
+  }
+  threadPoolWait(ctx->pool, &group);
+  arenaRelease(arena, mark);
+}
+
+// takes a context whose policy for the grid is not THREADS_INLINE, and a
+// grid
+// fills the grid as fillPuzzle does, in rounds: every region that can
+// offer a cell is examined in parallel, then the moves are applied by one
+// thread in region order, so the result does not depend on timing. The
+// first move to claim a cell wins; a later move putting another number in
+// the same cell is a conflict, counted and dropped, and leaves a duplicate
+// that validation reports.
+static void fillPuzzleParallel(const SudokuContext *ctx, SudokuGrid *grid) {
+  int psize = grid->psize;
+  int regions = 3 * psize;
+  Arena local = {NULL};
+  Arena *arena = scratchArena(ctx, &local);
+  ArenaMark mark = arenaMark(arena);
+  FillRound round;
+  round.grid = grid;
+  round.psize = psize;
+  round.n = (int)(sqrt(psize) + 0.5);
+  round.words = BITSET_WORDS(psize);
+  round.present =
+      arenaCalloc(arena, (size_t)regions * round.words, sizeof(uint64_t));
+  round.missing = arenaAlloc(arena, regions * sizeof(int));
+  round.moves = arenaAlloc(arena, regions * sizeof(FillMove));
+  round.regions = NULL;
+  // a region's count reaches one only once, so each list holds it at most
+  // once over the whole fill
+  int *lists[2] = {arenaAlloc(arena, regions * sizeof(int)),
+                   arenaAlloc(arena, regions * sizeof(int))};
+  int count = regions, examined = 0;
+  uint64_t cellsFilled = 0, conflicts = 0;
+  for (int r = 0; count > 0; r++) {
+    fillExamineAll(ctx, &round, count, arena);
+    examined += count;
+    int *next = lists[r % 2], pending = 0;
+    for (int i = 0; i < count; i++) {
+      FillMove move = round.moves[i];
+      if (move.num <= 0)
+        continue; // no empty cell, or a region with a duplicate
+      int held = gridGet(grid, move.row, move.col);
+      if (held != 0) {
+        // filled earlier in this merge, through another of its regions
+        conflicts += held != move.num;
+        continue;
       }
-      found[num] = 1;
-    }
-    data->valid = 1;
-  } else if (data->type == 1) {
-    // Validate a column. data->index holds the column number.
-    int col = data->index;
-    for (int row = 1; row <= psize; row++) {
-      int num = data->grid[row][col];
-      if (num < 1 || num > psize) {
-        data->valid = 0;
-        free(found);
-        pthread_exit(NULL);
-      }
-      if (found[num] == 1) {
-        data->valid = 0;
-        free(found);
-        pthread_exit(NULL);
-      }
-      found[num] = 1;
-    }
-    data->valid = 1;
-  } else if (data->type == 2) {
-    // Validate a subgrid. The top-left cell is at (startRow, startCol)
-    for (int row = data->startRow; row < data->startRow + data->n; row++) {
-      for (int col = data->startCol; col < data->startCol + data->n; col++) {
-        int num = data->grid[row][col];
-        if (num < 1 || num > psize) {
-          data->valid = 0;
-          free(found);
-          pthread_exit(NULL);
-        }
-        if (found[num] == 1) {
-          data->valid = 0;
-          free(found);
-          pthread_exit(NULL);
-        }
-        found[num] = 1;
+      gridSet(grid, move.row, move.col, move.num);
+      cellsFilled++;
+      int n = round.n;
+      int affected[3] = {move.row - 1, psize + move.col - 1,
+                         2 * psize + ((move.row - 1) / n) * n +
+                             (move.col - 1) / n};
+      for (int k = 0; k < 3; k++) {
+        int a = affected[k];
+        round.present[(size_t)a * round.words + (move.num - 1) / 64] |=
+            1ULL << ((move.num - 1) % 64);
+        if (--round.missing[a] == 1)
+          next[pending++] = a;
       }
     }
-    data->valid = 1;
+    round.regions = next;
+    count = pending;
   }
-  free(found);
-  pthread_exit(NULL);
+  arenaRelease(arena, mark);
+  arenaDestroy(&local);
+  STAT_ADD(ctx->stats, fillRegions, examined);
+  STAT_ADD(ctx->stats, cellsFilled, cellsFilled);
+  STAT_ADD(ctx->stats, fillConflicts, conflicts);
 }
 
-// takes puzzle size and grid[][] representing sudoku puzzle
-// and two booleans to be assigned: complete and valid.
-// row-0 and column-0 are ignored for convenience, so a 9x9 puzzle
-// has grid[1][1] as the top-left element and grid[9][9] as bottom right.
-// A puzzle is complete if it can be completed with no 0s in it.
-// If complete, a puzzle is valid if all rows/columns/boxes have numbers from 1
-// to psize. For incomplete puzzles, we cannot say anything about validity.
-void checkPuzzle(int psize, int **grid, bool *complete, bool *valid) {
+// takes a context (or NULL) and a grid
+// fills in any region missing exactly one number until no more progress.
+// Each region keeps a bitset of the numbers it holds and a count of its
+// empty cells, updated as cells are filled; regions reaching one empty
+// cell go on a worklist, so only regions affected by a fill are revisited.
+// Boards checked with the pool find their moves in parallel instead.
+void fillPuzzle(const SudokuContext *ctx, SudokuGrid *grid) {
+  if (chooseThreadPolicy(ctx, grid->psize) != THREADS_INLINE) {
+    fillPuzzleParallel(ctx, grid);
+    return;
+  }
+  SudokuStats *stats = ctx == NULL ? NULL : ctx->stats;
+  int psize = grid->psize;
   int n = (int)(sqrt(psize) + 0.5);
-  bool progress;
-  
-  // Attempt to complete the puzzle by filling in any region missing exactly one number.
-  do {
-    progress = false;
-    // Check rows.
-    for (int row = 1; row <= psize; row++) {
-      int missingCount = 0, missingCol = -1;
-      bool present[psize + 1];
-      for (int i = 1; i <= psize; i++) present[i] = false;
-      for (int col = 1; col <= psize; col++) {
-        int num = grid[row][col];
-        if (num == 0) {
-          missingCount++;
-          missingCol = col;
-        } else {
-          present[num] = true;
-        }
-      }
-      if (missingCount == 1) {
-        for (int num = 1; num <= psize; num++) {
-          if (!present[num]) {
-            grid[row][missingCol] = num;
-            progress = true;
-            break;
-          }
-        }
-      }
-    }
-    // Check columns.
+  int regions = 3 * psize;
+  int words = BITSET_WORDS(psize);
+  Arena local = {NULL};
+  Arena *arena = scratchArena(ctx, &local);
+  ArenaMark mark = arenaMark(arena);
+  uint64_t *present =
+      arenaCalloc(arena, (size_t)regions * words, sizeof(uint64_t));
+  int *missing = arenaCalloc(arena, regions, sizeof(int));
+  int *worklist = arenaAlloc(arena, regions * sizeof(int));
+  int pending = 0;
+  for (int row = 1; row <= psize; row++) {
     for (int col = 1; col <= psize; col++) {
-      int missingCount = 0, missingRow = -1;
-      bool present[psize + 1];
-      for (int i = 1; i <= psize; i++) present[i] = false;
-      for (int row = 1; row <= psize; row++) {
-        int num = grid[row][col];
-        if (num == 0) {
-          missingCount++;
-          missingRow = row;
-        } else {
-          present[num] = true;
-        }
-      }
-      if (missingCount == 1) {
-        for (int num = 1; num <= psize; num++) {
-          if (!present[num]) {
-            grid[missingRow][col] = num;
-            progress = true;
-            break;
-          }
-        }
+      int num = gridGet(grid, row, col);
+      int u[3] = {row - 1, psize + col - 1,
+                  2 * psize + ((row - 1) / n) * n + (col - 1) / n};
+      for (int i = 0; i < 3; i++) {
+        if (num == 0)
+          missing[u[i]]++;
+        else if (num > 0 && num <= psize)
+          present[u[i] * words + (num - 1) / 64] |= 1ULL << ((num - 1) % 64);
       }
     }
-    // Check subgrids.
-    for (int i = 0; i < n; i++) {
-      for (int j = 0; j < n; j++) {
-        int startRow = i * n + 1, startCol = j * n + 1;
-        int missingCount = 0, missingRow = -1, missingCol = -1;
-        bool present[psize + 1];
-        for (int k = 1; k <= psize; k++) present[k] = false;
-        for (int row = startRow; row < startRow + n; row++) {
-          for (int col = startCol; col < startCol + n; col++) {
-            int num = grid[row][col];
-            if (num == 0) {
-              missingCount++;
-              missingRow = row;
-              missingCol = col;
-            } else {
-              present[num] = true;
-            }
-          }
-        }
-        if (missingCount == 1) {
-          for (int num = 1; num <= psize; num++) {
-            if (!present[num]) {
-              grid[missingRow][missingCol] = num;
-              progress = true;
-              break;
-            }
-          }
-        }
-      }
+  }
+  for (int u = 0; u < regions; u++)
+    if (missing[u] == 1)
+      worklist[pending++] = u;
+  // a region is pushed only when its count drops to 1, so at most once
+  uint64_t regionsTaken = 0, cellsFilled = 0;
+  while (pending > 0) {
+    int u = worklist[--pending];
+    regionsTaken++;
+    if (missing[u] != 1)
+      continue;
+    int row = 0, col = 0;
+    for (int k = 0; k < psize; k++) {
+      regionCell(psize, n, u, k, &row, &col);
+      if (gridGet(grid, row, col) == 0)
+        break;
     }
-  } while (progress);
-  
+    int num = 0;
+    for (int w = 0; w < words && num == 0; w++) {
+      uint64_t absent = ~present[u * words + w] & fullMaskWord(psize, w);
+      if (absent != 0)
+        num = 64 * w + __builtin_ctzll(absent) + 1;
+    }
+    missing[u] = 0;
+    if (num == 0)
+      continue; // every number present already: the region has a duplicate
+    gridSet(grid, row, col, num);
+    cellsFilled++;
+    int affected[3] = {row - 1, psize + col - 1,
+                       2 * psize + ((row - 1) / n) * n + (col - 1) / n};
+    for (int i = 0; i < 3; i++) {
+      int r = affected[i];
+      present[r * words + (num - 1) / 64] |= 1ULL << ((num - 1) % 64);
+      if (r != u && --missing[r] == 1)
+        worklist[pending++] = r;
+    }
+  }
+  arenaRelease(arena, mark);
+  arenaDestroy(&local);
+  STAT_ADD(stats, fillRegions, regionsTaken);
+  STAT_ADD(stats, cellsFilled, cellsFilled);
+}
+
+// takes a grid as for checkPuzzle, without filling in any cells:
+// complete is true only if the grid has no 0s as given.
+static void verifyPuzzleUntimed(const SudokuContext *ctx,
+                                const SudokuGrid *grid, bool *complete,
+                                bool *valid) {
+  int psize = grid->psize;
+  ThreadPolicy policy = chooseThreadPolicy(ctx, psize);
+  // Common sizes checked inline go to the kernel compiled for their size,
+  // which answers both questions in one pass. It is at least as fast as
+  // the vector kernels, which remain for ctx->noFixed.
+  FixedKernel fixed = fixedKernel(psize);
+  if (policy == THREADS_INLINE && fixed != NULL &&
+      !(ctx != NULL && ctx->noFixed)) {
+    fixed(grid->cells, complete, valid);
+    return;
+  }
+  // Other inline boards are swept once using the region table of their
+  // size, unless the vector kernels take them.
+  bool vector = !(ctx != NULL && ctx->noSimd) && simdSupported(grid);
+  const RegionTable *table = NULL;
+  if (policy == THREADS_INLINE && !vector && ctx != NULL && ctx->tables != NULL)
+    table = regionTable(ctx->tables, psize);
+  if (table != NULL) {
+    validateBoardTable(ctx, table, grid, complete, valid);
+    return;
+  }
+  int n = (int)(sqrt(psize) + 0.5);
   // Check if the puzzle is complete.
   bool isComplete = true;
   for (int row = 1; row <= psize && isComplete; row++) {
     for (int col = 1; col <= psize; col++) {
-      if (grid[row][col] == 0) {
+      if (gridGet(grid, row, col) == 0) {
         isComplete = false;
         break;
       }
@@ -194,19 +1913,31 @@ void checkPuzzle(int psize, int **grid, bool *complete, bool *valid) {
     return;
   }
   
-  // If the puzzle is complete, validate it using multithreading.
+  // Inline boards that fit the vector kernels are checked all at once.
+  if (policy == THREADS_INLINE && vector) {
+    *valid = validateBoardSimd(grid);
+    return;
+  }
+
+  // Otherwise describe every region and check them as the policy says.
   int totalThreads = 3 * psize;
-  ThreadData *tdArray = malloc(totalThreads * sizeof(ThreadData));
-  pthread_t *threads = malloc(totalThreads * sizeof(pthread_t));
+  Arena local = {NULL};
+  Arena *arena = scratchArena(ctx, &local);
+  ArenaMark mark = arenaMark(arena);
+  ThreadData *tdArray = arenaAllocAligned(
+      arena, totalThreads * sizeof(ThreadData), CACHE_LINE);
   int threadIndex = 0;
+
+  // the first invalid region settles the verdict: inline checks stop
+  // there, and pool tasks skip their regions once stop is set
+  atomic_bool stop = false;
+  PuzzleInfo puzzle = {grid, psize, n, &stop};
   
   // Create threads to validate rows.
   for (int r = 1; r <= psize; r++) {
     tdArray[threadIndex].type = 0;
     tdArray[threadIndex].index = r;
-    tdArray[threadIndex].psize = psize;
-    tdArray[threadIndex].grid = grid;
-    tdArray[threadIndex].n = n;
+    tdArray[threadIndex].puzzle = &puzzle;
     threadIndex++;
   }
   
@@ -214,9 +1945,7 @@ void checkPuzzle(int psize, int **grid, bool *complete, bool *valid) {
   for (int c = 1; c <= psize; c++) {
     tdArray[threadIndex].type = 1;
     tdArray[threadIndex].index = c;
-    tdArray[threadIndex].psize = psize;
-    tdArray[threadIndex].grid = grid;
-    tdArray[threadIndex].n = n;
+    tdArray[threadIndex].puzzle = &puzzle;
     threadIndex++;
   }
   
@@ -224,101 +1953,1162 @@ void checkPuzzle(int psize, int **grid, bool *complete, bool *valid) {
   for (int i = 0; i < n; i++) {
     for (int j = 0; j < n; j++) {
       tdArray[threadIndex].type = 2;
-      tdArray[threadIndex].psize = psize;
-      tdArray[threadIndex].grid = grid;
-      tdArray[threadIndex].n = n;
+      tdArray[threadIndex].puzzle = &puzzle;
       tdArray[threadIndex].startRow = i * n + 1;
       tdArray[threadIndex].startCol = j * n + 1;
       threadIndex++;
     }
   }
   
-  // Spawn all threads.
-  for (int i = 0; i < totalThreads; i++) {
-    int rc = pthread_create(&threads[i], NULL, validateRegion, (void *)&tdArray[i]);
-    if (rc) {
-      fprintf(stderr, "Error: pthread_create failed\n");
-      exit(EXIT_FAILURE);
-    }
-  }
-  
-  // Wait for threads to complete and collect results.
   bool overallValid = true;
-  for (int i = 0; i < totalThreads; i++) {
-    pthread_join(threads[i], NULL);
-    if (tdArray[i].valid == 0)
-      overallValid = false;
+  if (policy == THREADS_INLINE) {
+    for (int i = 0; i < totalThreads && overallValid; i++) {
+      validateRegion(&tdArray[i]);
+      if (tdArray[i].valid == 0)
+        overallValid = false;
+    }
+  } else if (policy == THREADS_CHUNKED) {
+    // split the regions into one even run per worker
+    int chunks = ctx->pool->nworkers < totalThreads ? ctx->pool->nworkers
+                                                    : totalThreads;
+    RegionChunk *chunkArray = arenaAllocAligned(
+        arena, chunks * sizeof(RegionChunk), CACHE_LINE);
+    STAT_ADD(ctx->stats, tasks, chunks);
+    TaskGroup group = {0};
+    for (int c = 0, first = 0; c < chunks; c++) {
+      int last = (int)((long)totalThreads * (c + 1) / chunks);
+      chunkArray[c].regions = &tdArray[first];
+      chunkArray[c].count = last - first;
+      threadPoolSubmit(ctx->pool, &group, validateChunk, &chunkArray[c]);
+      first = last;
+    }
+    threadPoolWait(ctx->pool, &group);
+    for (int c = 0; c < chunks; c++) {
+      if (!chunkArray[c].valid)
+        overallValid = false;
+    }
+  } else {
+    // Submit every region to the pool.
+    TaskGroup group = {0};
+    STAT_ADD(ctx->stats, tasks, totalThreads);
+    for (int i = 0; i < totalThreads; i++)
+      threadPoolSubmit(ctx->pool, &group, validateRegion,
+                       (void *)&tdArray[i]);
+
+    // Wait for the regions to be checked and collect results.
+    threadPoolWait(ctx->pool, &group);
+    for (int i = 0; i < totalThreads; i++) {
+      if (tdArray[i].valid == 0)
+        overallValid = false;
+    }
   }
   *valid = overallValid;
   
-  free(tdArray);
-  free(threads);
+  arenaRelease(arena, mark);
+  arenaDestroy(&local);
+}
+
+void verifyPuzzle(const SudokuContext *ctx, const SudokuGrid *grid,
+                  bool *complete, bool *valid) {
+  SudokuStats *stats = ctx == NULL ? NULL : ctx->stats;
+  uint64_t start = STAT_START(stats);
+  verifyPuzzleUntimed(ctx, grid, complete, valid);
+  STAT_STOP(stats, validateNanos, start);
+  STAT_ADD(stats, puzzles, 1);
 }
 
-// takes filename and pointer to grid[][]
-// returns size of Sudoku puzzle and fills grid
-int readSudokuPuzzle(char *filename, int ***grid) {
-  FILE *fp = fopen(filename, "r");
-  if (fp == NULL) {
-    printf("Could not open file %s\n", filename);
-    exit(EXIT_FAILURE);
+// Result cache. A board is put in a canonical form before lookup, so
+// boards that differ by relabeling numbers, permuting rows within a band,
+// columns within a stack, bands, stacks, or by transposing can share an
+// entry. Lines are ordered by keys that do not change under those moves:
+// a row's key mixes its clue count with the keys of the columns its clues
+// sit in, which start from their clue counts, and a band's key mixes its
+// rows' keys. Numbers are then relabeled in order of first appearance.
+// Lines with equal keys keep their original order, so two equivalent
+// boards may still get different forms; that costs a miss, never a wrong
+// answer, since entries are matched on the whole canonical board and not
+// just its hash.
+
+// Boards beyond the solver are only verified, which is cheaper than
+// keeping them.
+#define RESULT_CACHE_MAX_PSIZE SOLVER_MAX_PSIZE
+
+// A cached check: the canonical puzzle and, after it, the canonical grid
+// checkPuzzle left, psize * psize cells each.
+typedef struct {
+  uint64_t hash;
+  int psize;       // 0 for a slot never used
+  int next;        // next entry in the same bucket, or -1
+  bool complete;
+  bool valid;
+  bool referenced; // set by hits, cleared as the clock hand passes
+  uint16_t *cells;
+} CacheEntry;
+
+// One lock's worth of entries, chained from buckets by hash, with a clock
+// hand for eviction.
+typedef struct {
+  _Alignas(CACHE_LINE) pthread_mutex_t lock;
+  CacheEntry *entries;
+  int capacity;
+  int used;
+  int hand;
+  int *buckets; // first entry per bucket, or -1
+  int bucketMask;
+} CacheShard;
+
+// Shards are picked by the top bits of the hash, buckets by the low ones.
+struct ResultCache {
+  int nshards; // a power of two
+  CacheShard *shards;
+};
+
+ResultCache *createResultCache(int capacity) {
+  if (capacity <= 0)
+    return NULL;
+  ResultCache *cache = malloc(sizeof(ResultCache));
+  // a few dozen entries per shard keeps the clock meaningful
+  cache->nshards = 1;
+  while (cache->nshards < 64 && cache->nshards * 64 <= capacity)
+    cache->nshards *= 2;
+  cache->shards =
+      aligned_alloc(CACHE_LINE, cache->nshards * sizeof(CacheShard));
+  for (int s = 0; s < cache->nshards; s++) {
+    CacheShard *shard = &cache->shards[s];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->capacity = (capacity + cache->nshards - 1) / cache->nshards;
+    shard->entries = calloc(shard->capacity, sizeof(CacheEntry));
+    shard->used = 0;
+    shard->hand = 0;
+    int buckets = 1;
+    while (buckets < 2 * shard->capacity)
+      buckets *= 2;
+    shard->bucketMask = buckets - 1;
+    shard->buckets = malloc(buckets * sizeof(int));
+    for (int b = 0; b < buckets; b++)
+      shard->buckets[b] = -1;
+  }
+  return cache;
+}
+
+void deleteResultCache(ResultCache *cache) {
+  if (cache == NULL)
+    return;
+  for (int s = 0; s < cache->nshards; s++) {
+    CacheShard *shard = &cache->shards[s];
+    for (int e = 0; e < shard->used; e++)
+      free(shard->entries[e].cells);
+    free(shard->entries);
+    free(shard->buckets);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  free(cache->shards);
+  free(cache);
+}
+
+// returns x with its bits mixed, as the splitmix64 finalizer does
+static inline uint64_t mixKey(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+// takes line keys for the n * n lines of a board with box width n
+// fills order with the lines, bands ordered by the sum of their lines'
+// mixed keys and lines within a band by key; ties keep their index order
+static void orderLines(int n, const uint64_t *lineKey, int *order) {
+  uint64_t bandKey[8];
+  int bands[8];
+  for (int b = 0; b < n; b++) {
+    bandKey[b] = 0;
+    for (int k = 0; k < n; k++)
+      bandKey[b] += mixKey(lineKey[b * n + k]);
   }
+  for (int b = 0; b < n; b++) {
+    int j = b;
+    for (; j > 0 && bandKey[bands[j - 1]] > bandKey[b]; j--)
+      bands[j] = bands[j - 1];
+    bands[j] = b;
+  }
+  for (int b = 0; b < n; b++) {
+    int *lines = &order[b * n];
+    for (int k = 0; k < n; k++) {
+      int line = bands[b] * n + k;
+      int j = k;
+      for (; j > 0 && lineKey[lines[j - 1]] > lineKey[line]; j--)
+        lines[j] = lines[j - 1];
+      lines[j] = line;
+    }
+  }
+}
+
+// Where a board sits in its class: canonical cell (i, j) is grid cell
+// (rows[i], cols[j]), or (rows[j], cols[i]) when transposed, given label.
+typedef struct {
   int psize;
-  fscanf(fp, "%d", &psize);
-  int **agrid = (int **)malloc((psize + 1) * sizeof(int *));
+  bool transposed;
+  int *rows;       // 0-indexed grid rows in canonical order
+  int *cols;
+  int *label;      // canonical number of each grid number, label[0] = 0
+  int *unlabel;    // grid number of each canonical number
+  uint16_t *cells; // the canonical puzzle
+  uint64_t hash;
+} CanonicalForm;
+
+// returns the grid number at canonical cell (i, j) of form
+static inline int canonicalSource(const SudokuGrid *grid,
+                                  const CanonicalForm *form, bool transposed,
+                                  int i, int j) {
+  return transposed ? gridGet(grid, form->rows[j] + 1, form->cols[i] + 1)
+                    : gridGet(grid, form->rows[i] + 1, form->cols[j] + 1);
+}
+
+// takes a grid, a form with rows and cols set and whether to transpose
+// writes the relabeled canonical cells and their labels
+static void relabelCanonical(const SudokuGrid *grid, CanonicalForm *form,
+                             bool transposed, uint16_t *cells, int *label) {
+  int psize = form->psize;
+  memset(label, 0, (psize + 1) * sizeof(int));
+  int next = 1;
+  for (int i = 0; i < psize; i++) {
+    for (int j = 0; j < psize; j++) {
+      int num = canonicalSource(grid, form, transposed, i, j);
+      if (num != 0 && label[num] == 0)
+        label[num] = next++;
+      cells[i * psize + j] = (uint16_t)label[num];
+    }
+  }
+  for (int num = 1; num <= psize; num++)
+    if (label[num] == 0)
+      label[num] = next++; // numbers absent from the puzzle, in order
+}
+
+// takes a grid, an arena for the form and the form to fill
+// computes the grid's canonical form and its hash
+// returns false if the grid cannot be cached: too large, not square, or
+// holding a number outside 0..psize
+static bool canonicalizeGrid(const SudokuGrid *grid, Arena *arena,
+                             CanonicalForm *form) {
+  int psize = grid->psize;
+  int n = (int)(sqrt(psize) + 0.5);
+  if (psize > RESULT_CACHE_MAX_PSIZE || n * n != psize)
+    return false;
+  int *rowClues = arenaCalloc(arena, 2 * psize, sizeof(int));
+  int *colClues = rowClues + psize;
+  for (int row = 1; row <= psize; row++) {
+    for (int col = 1; col <= psize; col++) {
+      int num = gridGet(grid, row, col);
+      if (num > psize)
+        return false;
+      if (num != 0)
+        rowClues[row - 1]++, colClues[col - 1]++;
+    }
+  }
+  uint64_t *rowKeys = arenaCalloc(arena, 2 * psize, sizeof(uint64_t));
+  uint64_t *colKeys = rowKeys + psize;
+  for (int row = 1; row <= psize; row++) {
+    for (int col = 1; col <= psize; col++) {
+      if (gridGet(grid, row, col) != 0) {
+        rowKeys[row - 1] += mixKey(colClues[col - 1] + 1);
+        colKeys[col - 1] += mixKey(rowClues[row - 1] + 1);
+      }
+    }
+  }
+  for (int i = 0; i < psize; i++) {
+    rowKeys[i] = (uint64_t)rowClues[i] << 48 ^ (rowKeys[i] >> 16);
+    colKeys[i] = (uint64_t)colClues[i] << 48 ^ (colKeys[i] >> 16);
+  }
+  // one more round with the crossing lines' keys splits most ties left
+  uint64_t *refined = arenaCalloc(arena, 2 * psize, sizeof(uint64_t));
   for (int row = 1; row <= psize; row++) {
-    agrid[row] = (int *)malloc((psize + 1) * sizeof(int));
     for (int col = 1; col <= psize; col++) {
-      fscanf(fp, "%d", &agrid[row][col]);
+      if (gridGet(grid, row, col) != 0) {
+        refined[row - 1] += mixKey(colKeys[col - 1]);
+        refined[psize + col - 1] += mixKey(rowKeys[row - 1]);
+      }
+    }
+  }
+  for (int i = 0; i < 2 * psize; i++)
+    rowKeys[i] = (rowKeys[i] & ~0xFFFFFFFFFFFFULL) | (refined[i] >> 16);
+  size_t cells = (size_t)psize * psize;
+  form->psize = psize;
+  form->rows = arenaAlloc(arena, 2 * psize * sizeof(int));
+  form->cols = form->rows + psize;
+  form->label = arenaAlloc(arena, 2 * (psize + 1) * sizeof(int));
+  form->unlabel = form->label + psize + 1;
+  form->cells = arenaAlloc(arena, 2 * cells * sizeof(uint16_t));
+  orderLines(n, rowKeys, form->rows);
+  orderLines(n, colKeys, form->cols);
+  // keep whichever orientation gives the smaller board
+  int *otherLabel = arenaAlloc(arena, (psize + 1) * sizeof(int));
+  uint16_t *other = form->cells + cells;
+  relabelCanonical(grid, form, false, form->cells, form->label);
+  relabelCanonical(grid, form, true, other, otherLabel);
+  form->transposed =
+      memcmp(other, form->cells, cells * sizeof(uint16_t)) < 0;
+  if (form->transposed) {
+    memcpy(form->cells, other, cells * sizeof(uint16_t));
+    memcpy(form->label, otherLabel, (psize + 1) * sizeof(int));
+  }
+  for (int num = 0; num <= psize; num++)
+    form->unlabel[form->label[num]] = num;
+  uint64_t hash = 0xCBF29CE484222325ULL ^ (uint64_t)psize;
+  for (size_t i = 0; i < cells; i++)
+    hash = (hash ^ form->cells[i]) * 0x100000001B3ULL;
+  form->hash = mixKey(hash);
+  return true;
+}
+
+// returns the shard holding a hash
+static inline CacheShard *cacheShard(ResultCache *cache, uint64_t hash) {
+  return &cache->shards[(hash >> 40) & (cache->nshards - 1)];
+}
+
+// returns the entry of shard matching form, or -1; the shard is locked
+static int cacheFind(CacheShard *shard, const CanonicalForm *form) {
+  size_t cells = (size_t)form->psize * form->psize;
+  int e = shard->buckets[form->hash & shard->bucketMask];
+  for (; e >= 0; e = shard->entries[e].next) {
+    CacheEntry *entry = &shard->entries[e];
+    if (entry->hash == form->hash && entry->psize == form->psize &&
+        memcmp(entry->cells, form->cells, cells * sizeof(uint16_t)) == 0)
+      return e;
+  }
+  return -1;
+}
+
+// takes a cache, a canonical form and where to copy a hit
+// returns true, with the canonical result in result, if form is cached
+static bool cacheLookup(ResultCache *cache, const CanonicalForm *form,
+                        uint16_t *result, bool *complete, bool *valid) {
+  CacheShard *shard = cacheShard(cache, form->hash);
+  size_t cells = (size_t)form->psize * form->psize;
+  pthread_mutex_lock(&shard->lock);
+  int e = cacheFind(shard, form);
+  if (e >= 0) {
+    CacheEntry *entry = &shard->entries[e];
+    entry->referenced = true;
+    memcpy(result, entry->cells + cells, cells * sizeof(uint16_t));
+    *complete = entry->complete;
+    *valid = entry->valid;
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return e >= 0;
+}
+
+// takes a cache, a canonical form, the canonical result and its verdict
+// stores the result, evicting with the clock if the shard is full
+// returns true if an entry was evicted
+static bool cacheInsert(ResultCache *cache, const CanonicalForm *form,
+                        const uint16_t *result, bool complete, bool valid) {
+  CacheShard *shard = cacheShard(cache, form->hash);
+  size_t cells = (size_t)form->psize * form->psize;
+  bool evicted = false;
+  pthread_mutex_lock(&shard->lock);
+  if (cacheFind(shard, form) >= 0) {
+    pthread_mutex_unlock(&shard->lock); // another worker got there first
+    return false;
+  }
+  int e;
+  if (shard->used < shard->capacity) {
+    e = shard->used++;
+  } else {
+    while (shard->entries[shard->hand].referenced) {
+      shard->entries[shard->hand].referenced = false;
+      shard->hand = (shard->hand + 1) % shard->capacity;
+    }
+    e = shard->hand;
+    shard->hand = (shard->hand + 1) % shard->capacity;
+    CacheEntry *victim = &shard->entries[e];
+    int *link = &shard->buckets[victim->hash & shard->bucketMask];
+    while (*link != e)
+      link = &shard->entries[*link].next;
+    *link = victim->next;
+    free(victim->cells);
+    evicted = true;
+  }
+  CacheEntry *entry = &shard->entries[e];
+  entry->hash = form->hash;
+  entry->psize = form->psize;
+  entry->complete = complete;
+  entry->valid = valid;
+  entry->referenced = false;
+  entry->cells = malloc(2 * cells * sizeof(uint16_t));
+  memcpy(entry->cells, form->cells, cells * sizeof(uint16_t));
+  memcpy(entry->cells + cells, result, cells * sizeof(uint16_t));
+  int *bucket = &shard->buckets[form->hash & shard->bucketMask];
+  entry->next = *bucket;
+  *bucket = e;
+  pthread_mutex_unlock(&shard->lock);
+  return evicted;
+}
+
+static void checkPuzzleUncached(const SudokuContext *ctx, SudokuGrid *grid,
+                                bool *complete, bool *valid);
+
+// checkPuzzle through ctx->results: a hit is mapped back onto grid through
+// the board's canonical form, and a miss is checked and then stored.
+static void checkPuzzleCached(const SudokuContext *ctx, SudokuGrid *grid,
+                              bool *complete, bool *valid) {
+  Arena local = {NULL};
+  Arena *arena = scratchArena(ctx, &local);
+  ArenaMark mark = arenaMark(arena);
+  CanonicalForm form;
+  if (!canonicalizeGrid(grid, arena, &form)) {
+    arenaRelease(arena, mark);
+    arenaDestroy(&local);
+    checkPuzzleUncached(ctx, grid, complete, valid);
+    return;
+  }
+  int psize = grid->psize;
+  uint16_t *result =
+      arenaAlloc(arena, (size_t)psize * psize * sizeof(uint16_t));
+  if (cacheLookup(ctx->results, &form, result, complete, valid)) {
+    for (int i = 0; i < psize; i++) {
+      for (int j = 0; j < psize; j++) {
+        int row = form.transposed ? form.rows[j] : form.rows[i];
+        int col = form.transposed ? form.cols[i] : form.cols[j];
+        gridSet(grid, row + 1, col + 1, form.unlabel[result[i * psize + j]]);
+      }
+    }
+    STAT_ADD(ctx->stats, cacheHits, 1);
+    STAT_ADD(ctx->stats, puzzles, 1);
+  } else {
+    checkPuzzleUncached(ctx, grid, complete, valid);
+    for (int i = 0; i < psize; i++) {
+      for (int j = 0; j < psize; j++) {
+        int num = canonicalSource(grid, &form, form.transposed, i, j);
+        result[i * psize + j] = (uint16_t)form.label[num];
+      }
+    }
+    bool evicted =
+        cacheInsert(ctx->results, &form, result, *complete, *valid);
+    STAT_ADD(ctx->stats, cacheMisses, 1);
+    STAT_ADD(ctx->stats, cacheEvictions, evicted);
+  }
+  arenaRelease(arena, mark);
+  arenaDestroy(&local);
+}
+
+// takes a grid representing sudoku puzzle
+// and two booleans to be assigned: complete and valid.
+// rows and columns are 1-indexed in gridGet/gridSet, so a 9x9 puzzle
+// has (1, 1) as the top-left element and (9, 9) as bottom right.
+// A puzzle is complete if it can be completed with no 0s in it.
+// If complete, a puzzle is valid if all rows/columns/boxes have numbers from 1
+// to psize. For incomplete puzzles, we cannot say anything about validity.
+// Region checks run on ctx->pool, which is reused across calls, as
+// ctx->threads dictates; a NULL ctx or pool validates every region on the
+// calling thread.
+// Cells the fill loop cannot reach are found by solvePuzzle, so every
+// solvable puzzle up to SOLVER_MAX_PSIZE comes back complete. With
+// ctx->results, boards equivalent to one checked before take its result.
+void checkPuzzle(const SudokuContext *ctx, SudokuGrid *grid, bool *complete,
+                 bool *valid) {
+  if (ctx != NULL && ctx->results != NULL)
+    checkPuzzleCached(ctx, grid, complete, valid);
+  else
+    checkPuzzleUncached(ctx, grid, complete, valid);
+}
+
+static void checkPuzzleUncached(const SudokuContext *ctx, SudokuGrid *grid,
+                                bool *complete, bool *valid) {
+  SudokuStats *stats = ctx == NULL ? NULL : ctx->stats;
+  uint64_t start = STAT_START(stats);
+  fillPuzzle(ctx, grid);
+  STAT_STOP(stats, fillNanos, start);
+  start = STAT_START(stats);
+  solvePuzzle(ctx, grid);
+  STAT_STOP(stats, solveNanos, start);
+  verifyPuzzle(ctx, grid, complete, valid);
+}
+
+// A board kept checked while cells are edited one at a time. Every row,
+// column and box counts how often it holds each number and how many of its
+// numbers appear more than once, so an edit updates validity by touching
+// only the three regions of its cell. Regions are numbered as in
+// regionCell: rows 0..psize-1, then columns, then boxes.
+struct SudokuBoard {
+  SudokuGrid *grid;
+  int psize;
+  int n;
+  uint16_t *counts;   // counts[region * psize + num - 1]
+  int *duplicates;    // numbers held more than once, per region
+  int conflicting;    // regions with any duplicate
+  long emptyCells;
+  long invalidCells;  // cells outside 0..psize, possible only as loaded
+};
+
+static inline int boardBox(const SudokuBoard *board, int row, int col) {
+  return ((row - 1) / board->n) * board->n + (col - 1) / board->n;
+}
+
+// adds delta (1 or -1) to the count of num in region
+static inline void boardCount(SudokuBoard *board, int region, int num,
+                              int delta) {
+  uint16_t *count = &board->counts[(size_t)region * board->psize + num - 1];
+  int before = *count;
+  *count += delta;
+  if (before == 1 && delta > 0 && board->duplicates[region]++ == 0)
+    board->conflicting++;
+  else if (before == 2 && delta < 0 && --board->duplicates[region] == 0)
+    board->conflicting--;
+}
+
+// adds delta to the counts of the number at row, col in its three regions
+static void boardCountCell(SudokuBoard *board, int row, int col, int delta) {
+  int num = gridGet(board->grid, row, col);
+  if (num == 0) {
+    board->emptyCells += delta;
+  } else if (num > board->psize) {
+    board->invalidCells += delta;
+  } else {
+    int psize = board->psize;
+    boardCount(board, row - 1, num, delta);
+    boardCount(board, psize + col - 1, num, delta);
+    boardCount(board, 2 * psize + boardBox(board, row, col), num, delta);
+  }
+}
+
+// takes a square grid, which is copied
+// returns a board holding the grid's cells with all counts set up, to be
+// released with deleteSudokuBoard, or NULL if psize is not a square
+SudokuBoard *createSudokuBoard(const SudokuGrid *grid) {
+  int psize = grid->psize;
+  int n = (int)(sqrt(psize) + 0.5);
+  if (n * n != psize)
+    return NULL;
+  SudokuBoard *board = malloc(sizeof(SudokuBoard));
+  board->grid = copySudokuGrid(grid);
+  board->psize = psize;
+  board->n = n;
+  board->counts = calloc((size_t)3 * psize * psize, sizeof(uint16_t));
+  board->duplicates = calloc(3 * psize, sizeof(int));
+  board->conflicting = 0;
+  board->emptyCells = 0;
+  board->invalidCells = 0;
+  for (int row = 1; row <= psize; row++)
+    for (int col = 1; col <= psize; col++)
+      boardCountCell(board, row, col, 1);
+  return board;
+}
+
+void deleteSudokuBoard(SudokuBoard *board) {
+  deleteSudokuPuzzle(board->grid);
+  free(board->counts);
+  free(board->duplicates);
+  free(board);
+}
+
+// takes a board, a 1-indexed row and column, a number (0 clears the cell)
+// and room for three region numbers
+// stores num in O(1) and lists the cell's regions that now hold some
+// number twice in conflicts
+// returns how many regions were listed, or -1 if row, col or num is out of
+// range, leaving the board unchanged
+int boardSet(SudokuBoard *board, int row, int col, int num, int conflicts[3]) {
+  int psize = board->psize;
+  if (row < 1 || row > psize || col < 1 || col > psize || num < 0 ||
+      num > psize)
+    return -1;
+  boardCountCell(board, row, col, -1);
+  gridSet(board->grid, row, col, num);
+  boardCountCell(board, row, col, 1);
+  int regions[3] = {row - 1, psize + col - 1,
+                    2 * psize + boardBox(board, row, col)};
+  int count = 0;
+  for (int i = 0; i < 3; i++) {
+    if (board->duplicates[regions[i]] > 0)
+      conflicts[count++] = regions[i];
+  }
+  return count;
+}
+
+// returns true if the board has no empty cells
+bool boardComplete(const SudokuBoard *board) {
+  return board->emptyCells == 0;
+}
+
+// returns true if the board is complete and every region holds each
+// number once; a full region without duplicates holds exactly 1..psize
+bool boardValid(const SudokuBoard *board) {
+  return boardComplete(board) && board->invalidCells == 0 &&
+         board->conflicting == 0;
+}
+
+// returns the cells of the board, valid until the next edit
+const SudokuGrid *boardGrid(const SudokuBoard *board) {
+  return board->grid;
+}
+
+// takes a board and a pointer to a list of conflicting regions
+// the list, to be freed by the caller, gets every region holding some
+// number twice, in region order
+// returns the number of regions listed
+int boardConflicts(const SudokuBoard *board, int **regions) {
+  *regions = malloc((board->conflicting > 0 ? board->conflicting : 1) *
+                    sizeof(int));
+  int count = 0;
+  for (int r = 0; r < 3 * board->psize && count < board->conflicting; r++) {
+    if (board->duplicates[r] > 0)
+      (*regions)[count++] = r;
+  }
+  return count;
+}
+
+// Pipes are read in blocks of PUZZLE_READ_SIZE as parsing needs them, and
+// mapped files are prefetched PUZZLE_READ_AHEAD bytes ahead of the parser,
+// so the disk or the writer upstream works while puzzles are checked.
+#define PUZZLE_READ_SIZE (1 << 20)
+#define PUZZLE_READ_AHEAD (8 << 20)
+
+// takes an input being streamed from a pipe
+// moves the unparsed bytes to the front of the buffer and reads more
+// returns false once the pipe is at its end (or failed) and closed
+static bool inputRefill(PuzzleInput *in) {
+  if (in->stream < 0)
+    return false;
+  char *buf = (char *)in->data;
+  memmove(buf, buf + in->pos, in->size - in->pos);
+  in->size -= in->pos;
+  in->pos = 0;
+  if (in->capacity - in->size < PUZZLE_READ_SIZE / 2) {
+    in->capacity *= 2;
+    in->data = buf = realloc(buf, in->capacity);
+  }
+  ssize_t got;
+  do
+    got = read(in->stream, buf + in->size, in->capacity - in->size);
+  while (got < 0 && errno == EINTR);
+  if (got <= 0) {
+    if (in->stream != STDIN_FILENO)
+      close(in->stream);
+    in->stream = -1;
+    return false;
+  }
+  in->size += got;
+  return true;
+}
+
+// takes a filename, or NULL or "-" for stdin, and the input to set up
+// returns false if the file cannot be opened or read. Text from a pipe is
+// streamed; a binary corpus from a pipe is read whole, since it is viewed
+// in place.
+bool openPuzzleInput(const char *filename, PuzzleInput *in) {
+  bool useStdin = filename == NULL || strcmp(filename, "-") == 0;
+  int fd = useStdin ? STDIN_FILENO : open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+  in->data = NULL;
+  in->size = 0;
+  in->pos = 0;
+  in->line = 1;
+  in->mapped = false;
+  in->borrowed = false;
+  in->stream = -1;
+  in->capacity = 0;
+  in->advised = 0;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      in->data = map;
+      in->size = st.st_size;
+      in->mapped = true;
+    }
+  }
+  if (!in->mapped) {
+    in->capacity = PUZZLE_READ_SIZE;
+    char *buf = malloc(in->capacity);
+    in->data = buf;
+    in->stream = fd;
+    // the first block tells text from a binary header
+    errno = 0;
+    while (in->size < BINARY_HEADER_SIZE && inputRefill(in))
+      ;
+    while (isBinaryInput(in) && inputRefill(in))
+      ;
+    if (in->stream < 0 && errno != 0) {
+      free(buf); // a read failed rather than reaching the end
+      return false;
+    }
+    return true;
+  }
+  if (!useStdin)
+    close(fd);
+  return true;
+}
+
+// takes a buffer of puzzle text or a binary corpus, which must outlive the
+// input, and the input to set up
+void openPuzzleBuffer(const char *data, size_t size, PuzzleInput *in) {
+  in->data = data;
+  in->size = size;
+  in->pos = 0;
+  in->line = 1;
+  in->mapped = false;
+  in->borrowed = true;
+  in->stream = -1;
+  in->capacity = 0;
+  in->advised = 0;
+}
+
+// releases the mapping or buffer behind in; a caller's buffer is left alone
+void closePuzzleInput(PuzzleInput *in) {
+  if (in->borrowed)
+    return;
+  if (in->mapped)
+    munmap((void *)in->data, in->size);
+  else
+    free((void *)in->data);
+  if (in->stream >= 0 && in->stream != STDIN_FILENO)
+    close(in->stream);
+}
+
+// skips whitespace, counting lines; returns false at the end of input
+static inline bool skipSpace(PuzzleInput *in) {
+  while (in->pos < in->size || inputRefill(in)) {
+    char c = in->data[in->pos];
+    if (c == '\n')
+      in->line++;
+    else if (c != ' ' && c != '\t' && c != '\r' && c != '\v' && c != '\f')
+      return true;
+    in->pos++;
+  }
+  return false;
+}
+
+// reads an unsigned decimal number no larger than limit at pos.
+// returns false, leaving pos at the offending text, if there is none there
+// or it is too big; *tooBig tells the two apart
+static inline bool scanNumber(PuzzleInput *in, long limit, long *value,
+                              bool *tooBig) {
+  // any number in range, and the byte after it, fits in the window kept
+  while (in->size - in->pos < 64 && inputRefill(in))
+    ;
+  const char *p = in->data + in->pos, *end = in->data + in->size;
+  long v = 0;
+  const char *start = p;
+  *tooBig = false;
+  while (p < end && (unsigned)(*p - '0') < 10) {
+    v = v * 10 + (*p - '0');
+    if (v > limit)
+      *tooBig = true, v = limit; // keep consuming digits, but cap the value
+    p++;
+  }
+  // a number must end at whitespace or the end of input
+  if (p == start || *tooBig ||
+      (p < end && *p != ' ' && *p != '\n' && *p != '\t' && *p != '\r' &&
+       *p != '\v' && *p != '\f'))
+    return false;
+  in->pos = p - in->data;
+  *value = v;
+  return true;
+}
+
+// takes an input and a buffer for an error message
+// reads the size that starts a puzzle
+// returns PARSE_END at the end of input, PARSE_ERROR if the size is bad
+static ParseStatus parsePuzzleSize(PuzzleInput *in, long *psize, char *error,
+                                   size_t errorSize) {
+  if (in->mapped && in->advised < in->size &&
+      in->pos + PUZZLE_READ_AHEAD > in->advised) {
+    size_t window = in->size - in->advised < PUZZLE_READ_AHEAD
+                        ? in->size - in->advised
+                        : PUZZLE_READ_AHEAD;
+    madvise((char *)in->data + in->advised, window, MADV_WILLNEED);
+    in->advised += PUZZLE_READ_AHEAD;
+  }
+  if (!skipSpace(in))
+    return PARSE_END;
+  bool tooBig;
+  if (!scanNumber(in, MAX_PSIZE, psize, &tooBig) || *psize == 0) {
+    snprintf(error, errorSize, "line %ld: expected a puzzle size 1..%d",
+             in->line, MAX_PSIZE);
+    return PARSE_ERROR;
+  }
+  return PARSE_OK;
+}
+
+// takes an input at a cell of a puzzle of psize, the cell's index and a
+// buffer for an error message
+// reads the cell's number
+// returns false, with a message saying why, if there is none to read
+static inline bool parsePuzzleCell(PuzzleInput *in, long psize, size_t i,
+                                   long *num, char *error, size_t errorSize) {
+  bool tooBig;
+  if (!skipSpace(in)) {
+    snprintf(error, errorSize, "puzzle ends after %zu of %zu cells", i,
+             (size_t)psize * psize);
+    return false;
+  }
+  if (!scanNumber(in, psize, num, &tooBig)) {
+    snprintf(error, errorSize, "line %ld: row %zu column %zu: %s", in->line,
+             i / psize + 1, i % psize + 1,
+             tooBig ? "number out of range" : "expected a number");
+    return false;
+  }
+  return true;
+}
+
+static ParseStatus parsePuzzleGrid(PuzzleInput *in, long psize, Arena *arena,
+                                   SudokuGrid **grid, char *error,
+                                   size_t errorSize);
+
+// takes an input, an arena for the grid (NULL for the heap), a pointer to
+// a grid and a buffer for an error message
+// parses the next puzzle (its size, then psize * psize cells separated by
+// whitespace) straight into a new grid. Text after the last cell is left
+// for the next call. Reports short input, non-numeric text and numbers
+// outside 0..psize instead of storing them.
+ParseStatus parseSudokuPuzzle(PuzzleInput *in, Arena *arena,
+                              SudokuGrid **grid, char *error,
+                              size_t errorSize) {
+  long psize;
+  ParseStatus status = parsePuzzleSize(in, &psize, error, errorSize);
+  if (status != PARSE_OK)
+    return status;
+  return parsePuzzleGrid(in, psize, arena, grid, error, errorSize);
+}
+
+// parseSudokuPuzzle after the size has been read
+static ParseStatus parsePuzzleGrid(PuzzleInput *in, long psize, Arena *arena,
+                                   SudokuGrid **grid, char *error,
+                                   size_t errorSize) {
+  ArenaMark mark = arena == NULL ? (ArenaMark){NULL, 0} : arenaMark(arena);
+  SudokuGrid *agrid = arenaCreateGrid(arena, (int)psize);
+  uint8_t *cells8 = agrid->cells;
+  uint16_t *cells16 = agrid->cells;
+  size_t ncells = (size_t)psize * psize;
+  for (size_t i = 0; i < ncells; i++) {
+    long num;
+    if (!parsePuzzleCell(in, psize, i, &num, error, errorSize)) {
+      if (arena == NULL)
+        deleteSudokuPuzzle(agrid);
+      else
+        arenaRelease(arena, mark);
+      return PARSE_ERROR;
     }
+    if (agrid->cellBytes == 1)
+      cells8[i] = (uint8_t)num;
+    else
+      cells16[i] = (uint16_t)num;
   }
-  fclose(fp);
   *grid = agrid;
-  return psize;
+  return PARSE_OK;
 }
 
-// takes puzzle size and grid[][]
-// prints the puzzle
-void printSudokuPuzzle(int psize, int **grid) {
-  printf("%d\n", psize);
-  for (int row = 1; row <= psize; row++) {
-    for (int col = 1; col <= psize; col++) {
-      printf("%d ", grid[row][col]);
+// takes a context (or NULL), an input at the cells of a puzzle of psize
+// and a buffer for an error message
+// reads the cells and verifies them as they go by, keeping a bitset of
+// the numbers seen per column, per box of the current band and for the
+// current row: psize * psize bits for the columns, psize * n for the
+// boxes, and no grid. Every number is in 1..psize once parsed, so a full
+// region is valid exactly when it repeats no number. Boards whose size is
+// not a square have no box that can hold every number, and are never
+// valid. Cells after the verdict is settled are still read.
+// returns false, with a message, on malformed cells
+static bool streamPuzzleCells(const SudokuContext *ctx, PuzzleInput *in,
+                              long psize, bool *complete, bool *valid,
+                              char *error, size_t errorSize) {
+  int n = (int)(sqrt(psize) + 0.5);
+  int words = BITSET_WORDS(psize);
+  Arena local = {NULL};
+  Arena *arena = scratchArena(ctx, &local);
+  ArenaMark mark = arenaMark(arena);
+  uint64_t *columns =
+      arenaCalloc(arena, (size_t)psize * words, sizeof(uint64_t));
+  uint64_t *boxes = arenaAlloc(arena, (size_t)n * words * sizeof(uint64_t));
+  uint64_t *row = arenaAlloc(arena, words * sizeof(uint64_t));
+  bool isComplete = true, isValid = (long)n * n == psize, ok = true;
+  for (long r = 0; r < psize && ok; r++) {
+    if (r % n == 0)
+      memset(boxes, 0, (size_t)n * words * sizeof(uint64_t));
+    memset(row, 0, words * sizeof(uint64_t));
+    for (long c = 0; c < psize; c++) {
+      long num;
+      if (!parsePuzzleCell(in, psize, r * psize + c, &num, error,
+                           errorSize)) {
+        ok = false;
+        break;
+      }
+      if (num == 0)
+        isComplete = false;
+      if (!isComplete || !isValid)
+        continue;
+      int word = (int)(num - 1) / 64;
+      uint64_t bit = 1ULL << ((num - 1) % 64);
+      uint64_t *column = &columns[c * words + word];
+      uint64_t *box = &boxes[(c / n) * words + word];
+      if ((row[word] | *column | *box) & bit)
+        isValid = false;
+      row[word] |= bit;
+      *column |= bit;
+      *box |= bit;
     }
-    printf("\n");
   }
-  printf("\n");
+  arenaRelease(arena, mark);
+  arenaDestroy(&local);
+  *complete = isComplete;
+  *valid = isComplete && isValid;
+  return ok;
 }
 
-// takes puzzle size and grid[][]
-// frees the memory allocated
-void deleteSudokuPuzzle(int psize, int **grid) {
-  for (int row = 1; row <= psize; row++) {
-    free(grid[row]);
+// takes a context (or NULL), an input, the smallest size to stream, an
+// arena for the grid (NULL for the heap), a pointer to a grid, the verdict
+// and a buffer for an error message
+// parses the next puzzle like parseSudokuPuzzle, except that a board of
+// at least minPsize is verified while it is read, as verifyPuzzle would
+// judge it, and *grid is set to NULL instead of building it
+ParseStatus parseOrVerifyPuzzle(const SudokuContext *ctx, PuzzleInput *in,
+                                int minPsize, Arena *arena,
+                                SudokuGrid **grid, bool *complete,
+                                bool *valid, char *error, size_t errorSize) {
+  long psize;
+  ParseStatus status = parsePuzzleSize(in, &psize, error, errorSize);
+  if (status != PARSE_OK)
+    return status;
+  if (psize < minPsize)
+    return parsePuzzleGrid(in, psize, arena, grid, error, errorSize);
+  SudokuStats *stats = ctx == NULL ? NULL : ctx->stats;
+  uint64_t begin = STAT_START(stats);
+  *grid = NULL;
+  if (!streamPuzzleCells(ctx, in, psize, complete, valid, error, errorSize))
+    return PARSE_ERROR;
+  STAT_STOP(stats, validateNanos, begin);
+  STAT_ADD(stats, puzzles, 1);
+  return PARSE_OK;
+}
+
+// returns the number of bits needed to store 0..psize
+int binaryCellBits(int psize) {
+  int bits = 1;
+  while ((1 << bits) <= psize)
+    bits++;
+  return bits;
+}
+
+// returns true if the input holds a binary corpus rather than text
+bool isBinaryInput(const PuzzleInput *in) {
+  return in->size >= 4 && memcmp(in->data, BINARY_MAGIC, 4) == 0;
+}
+
+// takes an input that isBinaryInput accepts, the corpus to set up and a
+// buffer for an error message
+// returns false if the header is bad or the puzzles are truncated
+bool openBinaryCorpus(const PuzzleInput *in, BinaryCorpus *corpus,
+                      char *error, size_t errorSize) {
+  const uint8_t *h = (const uint8_t *)in->data;
+  if (in->size < BINARY_HEADER_SIZE || h[4] != BINARY_VERSION) {
+    snprintf(error, errorSize, "unsupported binary header");
+    return false;
   }
-  free(grid);
+  corpus->bits = h[5];
+  corpus->psize = h[6] | h[7] << 8;
+  corpus->count = 0;
+  for (int i = 7; i >= 0; i--)
+    corpus->count = corpus->count << 8 | h[8 + i];
+  if (corpus->psize == 0 || corpus->psize > MAX_PSIZE ||
+      corpus->bits != binaryCellBits(corpus->psize)) {
+    snprintf(error, errorSize, "bad binary header: psize %d, %d bits",
+             corpus->psize, corpus->bits);
+    return false;
+  }
+  size_t cells = (size_t)corpus->psize * corpus->psize;
+  corpus->puzzleBytes = (cells * corpus->bits + 7) / 8;
+  corpus->first = h + BINARY_HEADER_SIZE;
+  if ((in->size - BINARY_HEADER_SIZE) / corpus->puzzleBytes < corpus->count) {
+    snprintf(error, errorSize, "binary corpus truncated: header says %llu "
+             "puzzles", (unsigned long long)corpus->count);
+    return false;
+  }
+  return true;
+}
+
+// takes packed cells, the bits per cell and a grid of the corpus' size
+// decodes the cells into grid; numbers above psize become invalid cells
+void unpackSudokuPuzzle(const uint8_t *packed, int bits, SudokuGrid *grid) {
+  size_t cells = (size_t)grid->psize * grid->psize;
+  if (bits == 4 && grid->cellBytes == 1) {
+    // nibbles: two cells per byte
+    uint8_t *out = grid->cells;
+    for (size_t i = 0; i < cells; i++) {
+      uint8_t num = packed[i / 2] >> (4 * (i % 2)) & 15;
+      out[i] = num <= grid->psize ? num : UINT8_MAX;
+    }
+    return;
+  }
+  uint64_t acc = 0;
+  int have = 0;
+  uint32_t mask = (1u << bits) - 1;
+  for (size_t i = 0; i < cells; i++) {
+    while (have < bits) {
+      acc |= (uint64_t)*packed++ << have;
+      have += 8;
+    }
+    gridSet(grid, (int)(i / grid->psize) + 1, (int)(i % grid->psize) + 1,
+            (int)(acc & mask));
+    acc >>= bits;
+    have -= bits;
+  }
+}
+
+// takes a grid, the bits per cell and an output buffer of the packed size
+// packs the cells as unpackSudokuPuzzle expects them
+void packSudokuPuzzle(const SudokuGrid *grid, int bits, uint8_t *packed) {
+  size_t cells = (size_t)grid->psize * grid->psize;
+  uint64_t acc = 0;
+  int have = 0;
+  for (size_t i = 0; i < cells; i++) {
+    acc |= (uint64_t)gridGet(grid, (int)(i / grid->psize) + 1,
+                             (int)(i % grid->psize) + 1) << have;
+    have += bits;
+    while (have >= 8) {
+      *packed++ = (uint8_t)acc;
+      acc >>= 8;
+      have -= 8;
+    }
+  }
+  if (have > 0)
+    *packed = (uint8_t)acc;
+}
+
+// Generator for benchmark corpora. Boards start from the pattern
+// solution and are shuffled with moves that keep a board valid: relabeling
+// numbers, swapping rows within a band, columns within a stack, and whole
+// bands and stacks.
+
+// returns the next number of a splitmix64 sequence
+static inline uint64_t nextRandom(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// returns true with probability chance, 0 never and 1 always
+static inline bool randomChance(uint64_t *state, double chance) {
+  return (nextRandom(state) >> 11) * 0x1.0p-53 < chance;
+}
+
+// returns a random number in 0..bound-1
+static inline int randomBelow(uint64_t *state, int bound) {
+  return (int)(nextRandom(state) % (uint64_t)bound);
+}
+
+// fills perm with a random permutation of 0..count-1
+static void randomPermutation(uint64_t *state, int *perm, int count) {
+  for (int i = 0; i < count; i++)
+    perm[i] = i;
+  for (int i = count - 1; i > 0; i--) {
+    int j = randomBelow(state, i + 1);
+    int t = perm[i];
+    perm[i] = perm[j];
+    perm[j] = t;
+  }
+}
+
+// takes a perfect-square puzzle size and a random state
+// returns a random complete, valid grid
+SudokuGrid *generateSolvedGrid(int psize, uint64_t *rng) {
+  int n = (int)(sqrt(psize) + 0.5);
+  int *label = malloc(psize * sizeof(int));
+  int *rows = malloc(psize * sizeof(int));
+  int *cols = malloc(psize * sizeof(int));
+  int *outer = malloc(n * sizeof(int));
+  int *inner = malloc(n * sizeof(int));
+  randomPermutation(rng, label, psize);
+  // row i of the result is pattern row rows[i]; likewise for columns
+  int *order[2] = {rows, cols};
+  for (int axis = 0; axis < 2; axis++) {
+    randomPermutation(rng, outer, n);
+    for (int band = 0; band < n; band++) {
+      randomPermutation(rng, inner, n);
+      for (int k = 0; k < n; k++)
+        order[axis][band * n + k] = outer[band] * n + inner[k];
+    }
+  }
+  SudokuGrid *grid = createSudokuGrid(psize);
+  for (int row = 0; row < psize; row++) {
+    int r = rows[row];
+    for (int col = 0; col < psize; col++) {
+      int pattern = (n * (r % n) + r / n + cols[col]) % psize;
+      gridSet(grid, row + 1, col + 1, label[pattern] + 1);
+    }
+  }
+  free(label);
+  free(rows);
+  free(cols);
+  free(outer);
+  free(inner);
+  return grid;
+}
+
+// empties each cell of grid with probability fraction
+void removeClues(SudokuGrid *grid, double fraction, uint64_t *rng) {
+  for (int row = 1; row <= grid->psize; row++)
+    for (int col = 1; col <= grid->psize; col++)
+      if (randomChance(rng, fraction))
+        gridSet(grid, row, col, 0);
 }
 
-// expects file name of the puzzle as argument in command line
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    printf("usage: ./sudoku puzzle.txt\n");
-    return EXIT_FAILURE;
-  }
-  // grid is a 2D array
-  int **grid = NULL;
-  // find grid size and fill grid
-  int sudokuSize = readSudokuPuzzle(argv[1], &grid);
-  bool valid = false;
-  bool complete = false;
-  checkPuzzle(sudokuSize, grid, &complete, &valid);
-  printf("Complete puzzle? ");
-  printf(complete ? "true\n" : "false\n");
-  if (complete) {
-    printf("Valid puzzle? ");
-    printf(valid ? "true\n" : "false\n");
-  }
-  printSudokuPuzzle(sudokuSize, grid);
-  deleteSudokuPuzzle(sudokuSize, grid);
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+// takes a grid and a random state
+// copies the number of a random clue over another clue in the same row,
+// column or box, leaving that region with a duplicate
+// returns false if no two clues share a region
+bool injectDuplicate(SudokuGrid *grid, uint64_t *rng) {
+  int psize = grid->psize;
+  int n = (int)(sqrt(psize) + 0.5);
+  // a few random tries find a pair on any board with a fair share of clues
+  for (int attempt = 0; attempt < 64 * psize; attempt++) {
+    int u = randomBelow(rng, 3 * psize);
+    int row = 0, col = 0, fromRow = 0, fromCol = 0;
+    regionCell(psize, n, u, randomBelow(rng, psize), &row, &col);
+    regionCell(psize, n, u, randomBelow(rng, psize), &fromRow, &fromCol);
+    int num = gridGet(grid, fromRow, fromCol);
+    int held = gridGet(grid, row, col);
+    if (num != 0 && held != 0 && held != num) {
+      gridSet(grid, row, col, num);
+      return true;
+    }
+  }
+  return false;
+}
+
+// takes a context (or NULL), a spec and a puzzle's seed and index
+// returns puzzle index of the corpus the spec and seed describe. Each
+// puzzle has a random state of its own, so a corpus comes out the same
+// whichever thread makes which puzzle. Clues are removed in a random
+// order; with spec->unique a removal is undone if the puzzle would gain a
+// second solution, so fewer holes than asked for may remain.
+SudokuGrid *generatePuzzle(const SudokuContext *ctx,
+                           const GeneratorSpec *spec, uint64_t seed,
+                           uint64_t index) {
+  uint64_t rng = seed ^ (index * 0xD1B54A32D192ED03ULL);
+  nextRandom(&rng);
+  SudokuGrid *grid = generateSolvedGrid(spec->psize, &rng);
+  int psize = spec->psize;
+  int cells = psize * psize;
+  if (spec->clues < 0 && !spec->unique) {
+    removeClues(grid, spec->holes, &rng);
+  } else {
+    int holes = spec->clues >= 0 ? cells - spec->clues
+                                 : (int)(spec->holes * cells + 0.5);
+    int *order = malloc(cells * sizeof(int));
+    randomPermutation(&rng, order, cells);
+    for (int i = 0; i < cells && holes > 0; i++) {
+      int row = order[i] / psize + 1, col = order[i] % psize + 1;
+      int num = gridGet(grid, row, col);
+      gridSet(grid, row, col, 0);
+      if (spec->unique && countSolutions(ctx, grid, 2) != 1)
+        gridSet(grid, row, col, num);
+      else
+        holes--;
+    }
+    free(order);
+  }
+  if (spec->invalid > 0 && randomChance(&rng, spec->invalid))
+    injectDuplicate(grid, &rng);
+  return grid;
+}
@@ -0,0 +1,323 @@
+// Sudoku puzzle verifier and solver library
+//
+// Every call takes its state from the caller: grids, arenas for scratch
+// and parsed puzzles, and a SudokuContext holding the worker pool, the
+// per-size caches and the counters. The library keeps no global state and
+// never exits the process, so independent contexts can be used from
+// different threads at once; one context may be shared by threads as long
+// as its scratch arena is left NULL.
+
+#ifndef SUDOKU_H
+#define SUDOKU_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Largest supported puzzle size; cells are at most 16 bits wide.
+#define MAX_PSIZE 65534
+
+// Largest board the backtracking solver handles; candidates are one uint64_t.
+#define SOLVER_MAX_PSIZE 64
+
+// A sudoku grid stored as one contiguous row-major block of narrow cells:
+// one byte per cell for boards smaller than 255x255, two bytes otherwise.
+// Values outside 0..psize are stored as the largest value of the cell
+// type, which is never a valid number for the board. cells may point at
+// a caller's own buffer of psize * psize * gridCellBytes(psize) bytes.
+typedef struct {
+  int psize;     // Puzzle size (e.g., 9 for a 9x9 puzzle)
+  int cellBytes; // 1 for uint8_t cells, 2 for uint16_t cells
+  void *cells;   // psize * psize cells
+} SudokuGrid;
+
+// returns the bytes per cell of a grid of size psize
+static inline int gridCellBytes(int psize) {
+  return psize < UINT8_MAX ? 1 : 2;
+}
+
+// returns the cell at 1-indexed row and column
+static inline int gridGet(const SudokuGrid *grid, int row, int col) {
+  size_t i = (size_t)(row - 1) * grid->psize + (col - 1);
+  return grid->cellBytes == 1 ? ((uint8_t *)grid->cells)[i]
+                              : ((uint16_t *)grid->cells)[i];
+}
+
+// stores num at 1-indexed row and column
+static inline void gridSet(SudokuGrid *grid, int row, int col, int num) {
+  size_t i = (size_t)(row - 1) * grid->psize + (col - 1);
+  int invalid = grid->cellBytes == 1 ? UINT8_MAX : UINT16_MAX;
+  if (num < 0 || num > grid->psize)
+    num = invalid;
+  if (grid->cellBytes == 1)
+    ((uint8_t *)grid->cells)[i] = (uint8_t)num;
+  else
+    ((uint16_t *)grid->cells)[i] = (uint16_t)num;
+}
+
+// Bump allocator for the scratch memory of a puzzle. Allocations are carved
+// from large blocks and never freed one at a time; arenaRelease rolls the
+// arena back to an earlier arenaMark, so everything a puzzle allocated goes
+// away with one pointer move. An arena starts zeroed ({NULL}).
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+  ArenaBlock *top; // block allocations come from, NULL until first use
+} Arena;
+
+// Position in an arena to roll back to.
+typedef struct {
+  ArenaBlock *block;
+  size_t used;
+} ArenaMark;
+
+void *arenaAllocAligned(Arena *arena, size_t bytes, size_t align);
+void *arenaAlloc(Arena *arena, size_t bytes);
+void *arenaCalloc(Arena *arena, size_t count, size_t size);
+ArenaMark arenaMark(const Arena *arena);
+void arenaRelease(Arena *arena, ArenaMark mark);
+void arenaDestroy(Arena *arena);
+
+// Grids come from an arena, or from the heap and go to deleteSudokuPuzzle.
+SudokuGrid *arenaCreateGrid(Arena *arena, int psize);
+SudokuGrid *createSudokuGrid(int psize);
+SudokuGrid *copySudokuGrid(const SudokuGrid *grid);
+void deleteSudokuPuzzle(SudokuGrid *grid);
+
+// Fixed-size work-stealing pool of worker threads, created once and reused
+// for every puzzle so that checkPuzzle does not pay for pthread_create/join.
+typedef struct ThreadPool ThreadPool;
+
+// Work item executed by the thread pool. Uses the same signature as a
+// pthread start routine so thread functions can be submitted unchanged.
+typedef void *(*TaskFn)(void *arg);
+
+// A set of submitted tasks that can be waited on together; starts zeroed.
+typedef struct {
+  atomic_int pending;
+} TaskGroup;
+
+int numCores(void);
+ThreadPool *threadPoolCreate(int nworkers);
+int threadPoolSize(const ThreadPool *pool);
+int threadPoolQueued(ThreadPool *pool);
+void threadPoolSubmit(ThreadPool *pool, TaskGroup *group, TaskFn fn,
+                      void *arg);
+int threadPoolCurrentWorker(const ThreadPool *pool);
+void threadPoolWait(ThreadPool *pool, TaskGroup *group);
+void threadPoolDestroy(ThreadPool *pool);
+
+// How the region checks of one puzzle are spread over the worker pool.
+typedef enum {
+  THREADS_AUTO,    // choose from the board size and the number of workers
+  THREADS_INLINE,  // every region on the calling thread (vector kernels
+                   // when the board fits them)
+  THREADS_CHUNKED, // one task per worker, each checking a run of regions
+  THREADS_FANOUT,  // one task per row, column and box
+} ThreadPolicy;
+
+// returns a monotonic timestamp in nanoseconds
+static inline uint64_t nowNanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Instrumentation for --stats. Counters are added once per call rather
+// than per event, so enabling them costs little; building with
+// -DSUDOKU_STATS=0 removes every counter update and timer.
+#ifndef SUDOKU_STATS
+#define SUDOKU_STATS 1
+#endif
+
+typedef struct {
+  atomic_ullong puzzles;          // puzzles checked
+  atomic_ullong parseNanos;       // reading and parsing input
+  atomic_ullong fillNanos;        // fillPuzzle
+  atomic_ullong solveNanos;       // solvePuzzle
+  atomic_ullong validateNanos;    // verifyPuzzle
+  atomic_ullong printNanos;       // formatting results
+  atomic_ullong poolNanos;        // starting the worker pool
+  atomic_ullong threadsCreated;   // worker threads started
+  atomic_ullong tasks;            // tasks submitted to the pool
+  atomic_ullong fillRegions;      // regions taken off the fill worklist
+  atomic_ullong cellsFilled;      // cells filled by fillPuzzle
+  atomic_ullong fillConflicts;    // cells two regions forced apart
+  atomic_ullong solverCalls;      // puzzles handed to the solver
+  atomic_ullong solverNodes;      // search nodes visited
+  atomic_ullong solverBacktracks; // branches undone
+  atomic_ullong allocations;      // heap allocations on the check path
+  atomic_ullong cacheHits;        // checks answered by the result cache
+  atomic_ullong cacheMisses;      // checks stored in the result cache
+  atomic_ullong cacheEvictions;   // results the cache dropped for room
+} SudokuStats;
+
+#if SUDOKU_STATS
+#define STAT_ADD(stats, field, n)                                            \
+  do {                                                                       \
+    if ((stats) != NULL)                                                     \
+      atomic_fetch_add_explicit(&(stats)->field, (n), memory_order_relaxed); \
+  } while (0)
+#define STAT_START(stats) ((stats) != NULL ? nowNanos() : 0)
+#define STAT_STOP(stats, field, start) STAT_ADD(stats, field, nowNanos() - (start))
+#else
+#define STAT_ADD(stats, field, n) ((void)(stats))
+#define STAT_START(stats) ((void)(stats), (uint64_t)0)
+#define STAT_STOP(stats, field, start) ((void)(stats), (void)(start))
+#endif
+
+// Per-size tables, built on first use and shared by every thread.
+typedef struct RegionTable RegionTable;
+typedef struct RegionTableCache RegionTableCache;
+typedef struct DlxCache DlxCache;
+
+RegionTableCache *createRegionTableCache(void);
+void deleteRegionTableCache(RegionTableCache *cache);
+const RegionTable *regionTable(RegionTableCache *cache, int psize);
+DlxCache *createDlxCache(void);
+void deleteDlxCache(DlxCache *cache);
+
+// Bounded cache of checkPuzzle results keyed by a board's canonical form,
+// safe to share between threads. capacity is in entries; 0 gives NULL.
+typedef struct ResultCache ResultCache;
+
+ResultCache *createResultCache(int capacity);
+void deleteResultCache(ResultCache *cache);
+
+// Search used to fill in puzzles the fill loop cannot finish.
+typedef enum {
+  ENGINE_BITMASK, // candidate masks with propagation, parallel when large
+  ENGINE_DLX,     // Dancing Links exact cover
+} SolverEngine;
+
+// Settings shared by every checkPuzzle call. All fields may be left
+// zeroed: no pool checks on the calling thread, and no caches walks
+// regions and solves with the bitmask engine.
+typedef struct {
+  ThreadPool *pool;     // workers for region checks, NULL for none
+  ThreadPolicy threads; // how region checks use the pool
+  bool noSimd;          // validate inline boards with scalar code only
+  bool noFixed;         // skip the kernels specialized for common sizes
+  RegionTableCache *tables; // region tables by size, NULL to walk regions
+  SolverEngine engine;
+  DlxCache *matrices;   // DLX matrices by size, needed for ENGINE_DLX
+  ResultCache *results; // checkPuzzle results to reuse, or NULL
+  SudokuStats *stats;   // counters for --stats, or NULL
+  Arena *scratch;       // scratch for calls on threads outside pool, or
+                        // NULL to use a fresh arena per call
+} SudokuContext;
+
+ThreadPolicy chooseThreadPolicy(const SudokuContext *ctx, int psize);
+bool parseThreadPolicy(const char *name, ThreadPolicy *policy);
+
+// Checking and solving. ctx may be NULL throughout.
+void fillPuzzle(const SudokuContext *ctx, SudokuGrid *grid);
+bool solvePuzzle(const SudokuContext *ctx, SudokuGrid *grid);
+long countSolutions(const SudokuContext *ctx, const SudokuGrid *grid,
+                    long limit);
+void verifyPuzzle(const SudokuContext *ctx, const SudokuGrid *grid,
+                  bool *complete, bool *valid);
+void checkPuzzle(const SudokuContext *ctx, SudokuGrid *grid, bool *complete,
+                 bool *valid);
+bool simdSupported(const SudokuGrid *grid);
+bool fixedKernelSupported(int psize);
+
+// A board kept checked while cells are edited one at a time.
+typedef struct SudokuBoard SudokuBoard;
+
+SudokuBoard *createSudokuBoard(const SudokuGrid *grid);
+void deleteSudokuBoard(SudokuBoard *board);
+const SudokuGrid *boardGrid(const SudokuBoard *board);
+int boardSet(SudokuBoard *board, int row, int col, int num, int conflicts[3]);
+bool boardComplete(const SudokuBoard *board);
+bool boardValid(const SudokuBoard *board);
+int boardConflicts(const SudokuBoard *board, int **regions);
+
+// Puzzle text held in memory for parsing: regular files are mapped,
+// anything else (stdin, pipes) is streamed through a heap buffer that
+// parsing refills, and openPuzzleBuffer parses a caller's buffer in place.
+typedef struct {
+  const char *data;
+  size_t size;
+  size_t pos;      // next byte to parse
+  long line;       // line number of pos, for error messages
+  bool mapped;     // data is an mmap rather than a malloc
+  bool borrowed;   // data belongs to the caller
+  int stream;      // pipe still being read into data, or -1
+  size_t capacity; // bytes allocated for a streamed buffer
+  size_t advised;  // bytes of a mapping already prefetched
+} PuzzleInput;
+
+// Outcome of parsing one puzzle.
+typedef enum {
+  PARSE_OK,    // a puzzle was read
+  PARSE_END,   // only whitespace was left
+  PARSE_ERROR, // the input is malformed; the message says why
+} ParseStatus;
+
+bool openPuzzleInput(const char *filename, PuzzleInput *in);
+void openPuzzleBuffer(const char *data, size_t size, PuzzleInput *in);
+void closePuzzleInput(PuzzleInput *in);
+ParseStatus parseSudokuPuzzle(PuzzleInput *in, Arena *arena,
+                              SudokuGrid **grid, char *error,
+                              size_t errorSize);
+ParseStatus parseOrVerifyPuzzle(const SudokuContext *ctx, PuzzleInput *in,
+                                int minPsize, Arena *arena,
+                                SudokuGrid **grid, bool *complete,
+                                bool *valid, char *error, size_t errorSize);
+
+// Packed binary corpus: a 16-byte header followed by count puzzles of
+// psize * psize cells each, bitsPerCell = ceil(log2(psize + 1)) bits per
+// cell, packed row-major from the least significant bit and padded to a
+// whole byte per puzzle. A 9x9 puzzle has 4-bit cells and takes 41 bytes.
+//   0  "SDKB"           4  version (1)      5  bitsPerCell
+//   6  psize (uint16)   8  count (uint64)   all little-endian
+#define BINARY_MAGIC "SDKB"
+#define BINARY_VERSION 1
+#define BINARY_HEADER_SIZE 16
+
+// A binary corpus viewed in place; puzzles stay packed in the input.
+typedef struct {
+  int psize;
+  int bits;             // bits per cell
+  size_t puzzleBytes;   // packed size of one puzzle
+  uint64_t count;
+  const uint8_t *first; // packed cells of puzzle 0
+} BinaryCorpus;
+
+// returns the packed cells of puzzle i of the corpus
+static inline const uint8_t *binaryPuzzle(const BinaryCorpus *corpus,
+                                          uint64_t i) {
+  return corpus->first + i * corpus->puzzleBytes;
+}
+
+int binaryCellBits(int psize);
+bool isBinaryInput(const PuzzleInput *in);
+bool openBinaryCorpus(const PuzzleInput *in, BinaryCorpus *corpus,
+                      char *error, size_t errorSize);
+void unpackSudokuPuzzle(const uint8_t *packed, int bits, SudokuGrid *grid);
+void packSudokuPuzzle(const SudokuGrid *grid, int bits, uint8_t *packed);
+
+// Random boards for benchmarks and tests, from a splitmix64 state.
+SudokuGrid *generateSolvedGrid(int psize, uint64_t *rng);
+void removeClues(SudokuGrid *grid, double fraction, uint64_t *rng);
+bool injectDuplicate(SudokuGrid *grid, uint64_t *rng);
+
+// What generatePuzzle makes: solved boards of psize with clues removed,
+// either down to a clue count or, for a rough difficulty, a fraction of
+// cells emptied at random.
+typedef struct {
+  int psize;
+  int clues;      // clues to leave, or -1 to empty a fraction of cells
+  double holes;   // fraction of cells to empty when clues is -1
+  bool unique;    // only keep removals that leave a single solution
+  double invalid; // chance of planting a duplicate in the puzzle
+} GeneratorSpec;
+
+SudokuGrid *generatePuzzle(const SudokuContext *ctx,
+                           const GeneratorSpec *spec, uint64_t seed,
+                           uint64_t index);
+
+#endif